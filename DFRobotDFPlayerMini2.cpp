@@ -13,16 +13,16 @@
 
 #include "DFRobotDFPlayerMini2.h"
 
-void DFRobotDFPlayerMini2::setTimeOut(unsigned long timeOutDuration){
+void DFRobotDFPlayerMini2Core::setTimeOut(unsigned long timeOutDuration){
   _timeOutDuration = timeOutDuration;
 }
 
-void DFRobotDFPlayerMini2::uint16ToArray(uint16_t value, uint8_t *array){
+void DFRobotDFPlayerMini2Core::uint16ToArray(uint16_t value, uint8_t *array){
   *array = (uint8_t)(value>>8);
   *(array+1) = (uint8_t)(value);
 }
 
-uint16_t DFRobotDFPlayerMini2::calculateCheckSum(uint8_t *buffer){
+uint16_t DFRobotDFPlayerMini2Core::calculateCheckSum(uint8_t *buffer){
   uint16_t sum = 0;
   for (int i=Stack_Version; i<Stack_CheckSum; i++) {
     sum += buffer[i];
@@ -30,58 +30,147 @@ uint16_t DFRobotDFPlayerMini2::calculateCheckSum(uint8_t *buffer){
   return -sum;
 }
 
-void DFRobotDFPlayerMini2::sendStack(){
-  if (_sending[Stack_ACK]) {  //if the ack mode is on wait until the last transmition
-    while (_isSending) {
-      delay(0);
-      available();
-    }
-  }
-
+void DFRobotDFPlayerMini2Core::writeStack(uint8_t *buffer){
 #ifdef _DEBUG
   Serial.println();
   Serial.print(F("sending:"));
   for (int i=0; i<DFPLAYER_SEND_LENGTH; i++) {
-    Serial.print(_sending[i],HEX);
+    Serial.print(buffer[i],HEX);
     Serial.print(F(" "));
   }
   Serial.println();
 #endif
-  _serial->write(_sending, DFPLAYER_SEND_LENGTH);
-  _timeOutTimer = millis();
-  _isSending = _sending[Stack_ACK];
+#ifdef DFPLAYER_TRACE
+  trace(DFPLAYER_TRACE_TX, buffer[Stack_Command], arrayToUint16(buffer+Stack_Parameter));
+#endif
+  _serial->write(buffer, DFPLAYER_SEND_LENGTH);
+  _lastWrite = micros();
+  //errors are charged to _lastCommand only if it was the frame written last, not a
+  //query or a direct write of trigger() or the fade
+  _lastTracked = buffer[Stack_Command] == _lastCommand && arrayToUint16(buffer+Stack_Parameter) == _lastParameter;
+}
+
+void DFRobotDFPlayerMini2Core::flushSendQueue(){
+#ifdef DFPLAYER_SEND_QUEUE
+  //token bucket with a depth of one frame: a frame is released once DFPLAYER_SEND_INTERVAL
+  //has passed since the previous one. The release time advances by exactly one interval
+  //while the queue is drained, so a burst of n frames takes n intervals in total.
+  while (_sendQueueCount) {
+    unsigned long now = micros();
+    unsigned long elapsed = now - _sendTimer;
+    if (elapsed < DFPLAYER_SEND_INTERVAL) {
+      return;
+    }
+    writeStack(_sendQueue[_sendQueueHead]);
+    _sendTimer = (elapsed < 2 * DFPLAYER_SEND_INTERVAL) ? _sendTimer + DFPLAYER_SEND_INTERVAL : now;
+    _sendQueueHead = (_sendQueueHead + 1) % DFPLAYER_SEND_QUEUE_LENGTH;
+    _sendQueueCount--;
+  }
+#endif
+}
+
+bool DFRobotDFPlayerMini2Core::sendPending(){
+#ifdef DFPLAYER_SEND_QUEUE
+  return _sendQueueCount;
+#else
+  return false;
+#endif
+}
+
+void DFRobotDFPlayerMini2Core::waitFrameGap(){
+  //minimum gap to the previous frame, waited out through idle() so that the idle
+  //hook can sleep; idle() may write a frame itself, so the gap is checked again
+  unsigned long elapsed;
+  while ((elapsed = micros() - _lastWrite) < DFPLAYER_SEND_INTERVAL) {
+    idle(millis(), (DFPLAYER_SEND_INTERVAL - elapsed + 999) / 1000);
+  }
+}
+
+void DFRobotDFPlayerMini2Core::sendStack(){
+  if (_sending[Stack_ACK]) {  //if the ack mode is on wait until the last transmition
+    while (_isSending) {
+      idle(_timeOutTimer, _timeOutDuration);
+      available();
+    }
+    //frames queued without ACK (e.g. by readSnapshot()) go out first
+    while (sendPending()) {
+      idle(millis(), DFPLAYER_SEND_INTERVAL / 1000);
+      flushSendQueue();
+    }
+    //keep the minimum gap to frames written without ACK by writeFrame()
+    waitFrameGap();
+    writeStack(_sending);
+    _timeOutTimer = millis();
+    _isSending = true;
+    return;
+  }
   
-  if (!_sending[Stack_ACK]) { //if the ack mode is off wait 10 ms after one transmition.
-    delay(10);
+#ifdef DFPLAYER_SEND_QUEUE
+  //if the ack mode is off queue the frame, it is released by flushSendQueue() once the
+  //minimum gap to the previous frame has passed.
+  while (_sendQueueCount == DFPLAYER_SEND_QUEUE_LENGTH) {
+    idle(millis(), DFPLAYER_SEND_INTERVAL / 1000);
+    flushSendQueue();
   }
+  memcpy(_sendQueue[(_sendQueueHead + _sendQueueCount) % DFPLAYER_SEND_QUEUE_LENGTH], _sending, DFPLAYER_SEND_LENGTH);
+  _sendQueueCount++;
+  _timeOutTimer = millis();
+  _isSending = false;
+  flushSendQueue();
+#else
+  //without the queue the frame is written at once if the gap to the previous one
+  //has passed, otherwise after the rest of the gap
+  waitFrameGap();
+  writeStack(_sending);
+  _timeOutTimer = millis();
+  _isSending = false;
+#endif
 }
 
-void DFRobotDFPlayerMini2::sendStack(uint8_t command){
+void DFRobotDFPlayerMini2Core::sendStack(uint8_t command){
   sendStack(command, 0);
 }
 
-void DFRobotDFPlayerMini2::sendStack(uint8_t command, uint16_t argument){
+void DFRobotDFPlayerMini2Core::sendStack(uint8_t command, uint16_t argument){
+  if (_moduleSleeping && command != 0x09 && command != 0x0A && command != 0x0C) {
+    wakeModule();
+  }
+  if (_deviceSwitching && command != 0x09) {
+    while (millis() - _deviceSwitchTimer < DFPLAYER_DEVICE_SWITCH_TIME) {
+      idle(_deviceSwitchTimer, DFPLAYER_DEVICE_SWITCH_TIME);
+    }
+    _deviceSwitching = false;
+  }
+#ifdef DFPLAYER_AUTO_SLEEP
+  _lastActivity = millis();
+#endif
+  if (command < 0x3C) {
+    _lastCommand = command;
+    _lastParameter = argument;
+    shadowCommand(command, argument);
+  }
+  
   _sending[Stack_Command] = command;
   uint16ToArray(argument, _sending+Stack_Parameter);
   uint16ToArray(calculateCheckSum(_sending), _sending+Stack_CheckSum);
   sendStack();
 }
 
-void DFRobotDFPlayerMini2::sendStack(uint8_t command, uint8_t argumentHigh, uint8_t argumentLow){
+void DFRobotDFPlayerMini2Core::sendStack(uint8_t command, uint8_t argumentHigh, uint8_t argumentLow){
   uint16_t buffer = argumentHigh;
   buffer <<= 8;
   sendStack(command, buffer | argumentLow);
 }
 
-void DFRobotDFPlayerMini2::enableACK(){
+void DFRobotDFPlayerMini2Core::enableACK(){
   _sending[Stack_ACK] = 0x01;
 }
 
-void DFRobotDFPlayerMini2::disableACK(){
+void DFRobotDFPlayerMini2Core::disableACK(){
   _sending[Stack_ACK] = 0x00;
 }
 
-bool DFRobotDFPlayerMini2::waitAvailable(unsigned long duration){
+bool DFRobotDFPlayerMini2Core::waitAvailable(unsigned long duration){
   unsigned long timer = millis();
   if (!duration) {
     duration = _timeOutDuration;
@@ -90,13 +179,175 @@ bool DFRobotDFPlayerMini2::waitAvailable(unsigned long duration){
     if (millis() - timer > duration) {
       return false;
     }
-    delay(0);
+    idle(timer, duration);
   }
   return true;
 }
 
-bool DFRobotDFPlayerMini2::begin(Stream &stream, bool isACK, bool doReset){
+void DFRobotDFPlayerMini2Core::idle(unsigned long timer, unsigned long duration){
+  unsigned long elapsed = millis() - timer;
+  serviceTrigger();
+#ifdef DFPLAYER_FADE
+  fadeUpdate();
+#endif
+  flushSendQueue();
+  if (_idleHook && elapsed < duration) {
+    unsigned long remaining = duration - elapsed;
+    if (sendPending() && remaining > DFPLAYER_SEND_INTERVAL / 1000) {
+      remaining = DFPLAYER_SEND_INTERVAL / 1000;  //wake up in time to release the next queued frame
+    }
+    unsigned long start = micros();
+    _idleHook(remaining);
+    _idleTime += micros() - start;
+  }
+  else{
+    delay(0);
+  }
+}
+
+#ifdef DFPLAYER_TRIGGER
+void DFRobotDFPlayerMini2Core::trigger(int fileNumber, bool overMusic){
+  unsigned long requestTime = micros();
+  if (_moduleSleeping) {
+    wakeModule();
+  }
+  bool playing = read_play_status_from_pin();
+  
+  //bounded latency: the rest of the frame gap is spun out, not passed to the idle hook
+  while (micros() - _lastWrite < DFPLAYER_SEND_INTERVAL) {
+  }
+  writeFrame((overMusic && playing) ? 0x13 : 0x12, fileNumber);
+#ifdef DFPLAYER_AUTO_SLEEP
+  _lastActivity = millis();
+#endif
+  
+  _triggerTime = requestTime;
+  _triggerBusyPending = !playing;
+  if (_lastWrite - requestTime > _triggerSendLatencyMax) {
+    _triggerSendLatencyMax = _lastWrite - requestTime;
+  }
+}
+#endif
+
+void DFRobotDFPlayerMini2Core::writeFrame(uint8_t command, uint16_t parameter){
+  //own buffer: _sending may hold a frame that is still waiting for its ACK slot
+  uint8_t frame[DFPLAYER_SEND_LENGTH];
+  memcpy(frame, _sending, DFPLAYER_SEND_LENGTH);
+  frame[Stack_Command] = command;
+  frame[Stack_ACK] = 0x00;
+  uint16ToArray(parameter, frame+Stack_Parameter);
+  uint16ToArray(calculateCheckSum(frame), frame+Stack_CheckSum);
+  
+  waitFrameGap();
+  writeStack(frame);
+#ifdef DFPLAYER_SEND_QUEUE
+  _sendTimer = _lastWrite;  //queued frames keep their gap to this one
+#endif
+}
+
+#ifdef DFPLAYER_TRIGGER
+void DFRobotDFPlayerMini2Core::requestTrigger(int fileNumber, bool overMusic){
+  _triggerOverMusic = overMusic;
+  _triggerRequestTime = micros();
+  _triggerRequest = fileNumber;
+}
+
+#endif
+
+void DFRobotDFPlayerMini2Core::serviceTrigger(){
+#ifdef DFPLAYER_TRIGGER
+  if (!_triggerRequest) {
+    return;
+  }
+  noInterrupts();
+  int fileNumber = _triggerRequest;
+  bool overMusic = _triggerOverMusic;
+  unsigned long requestTime = _triggerRequestTime;
+  _triggerRequest = 0;
+  interrupts();
+  
+  trigger(fileNumber, overMusic);
+  //measure from the interrupt, not from the moment the request was picked up
+  _triggerTime = requestTime;
+  if (_lastWrite - requestTime > _triggerSendLatencyMax) {
+    _triggerSendLatencyMax = _lastWrite - requestTime;
+  }
+#endif
+}
+
+#ifdef DFPLAYER_TRIGGER
+unsigned long DFRobotDFPlayerMini2Core::readTriggerLatency(){
+  return _triggerLatency;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readTriggerLatencyMax(){
+  return _triggerLatencyMax;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readTriggerSendLatencyMax(){
+  return _triggerSendLatencyMax;
+}
+#endif
+
+void DFRobotDFPlayerMini2Core::setIdleHook(void (*hook)(unsigned long duration)){
+  _idleHook = hook;
+}
+
+void DFRobotDFPlayerMini2Core::setBusyPin(uint8_t pin){
+  _busyPin = pin;
+}
+
+#ifdef DFPLAYER_AUTO_SLEEP
+void DFRobotDFPlayerMini2Core::setAutoSleep(unsigned long idleSeconds){
+  _autoSleepTime = idleSeconds * 1000;
+  _lastActivity = millis();
+}
+#endif
+
+bool DFRobotDFPlayerMini2Core::isSleeping(){
+  return _moduleSleeping;
+}
+
+void DFRobotDFPlayerMini2Core::wakeModule(){
+  _moduleSleeping = false;
+  
+  //the wake frame always requests an ACK, its arrival ends the wait
+  uint8_t ack = _sending[Stack_ACK];
+  enableACK();
+  sendStack(0x09, device);
+  _sending[Stack_ACK] = ack;
+  unsigned long timer = millis();
+  while (_isSending && millis() - timer < DFPLAYER_WAKE_TIME) {
+    idle(timer, DFPLAYER_WAKE_TIME);
+    available();
+  }
+  _isSending = false;
+  _wakeLatency = millis() - timer;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readWakeLatency(){
+  return _wakeLatency;
+}
+
+uint8_t DFRobotDFPlayerMini2Core::readDutyCycle(){
+  unsigned long total = micros() - _statsStart;
+  if (!total) {
+    return 100;
+  }
+  return 100 - (uint8_t)((unsigned long long)_idleTime * 100 / total);
+}
+
+void DFRobotDFPlayerMini2Core::resetDutyCycle(){
+  _statsStart = micros();
+  _idleTime = 0;
+}
+
+bool DFRobotDFPlayerMini2Core::begin(Stream &stream, bool isACK, bool doReset){
   _serial = &stream;
+#ifdef DFPLAYER_BEGIN_ASYNC
+  _beginState = DFPLAYER_BEGIN_DONE;
+#endif
+  _beginStart = millis();
   
   if (isACK) {
     enableACK();
@@ -115,69 +366,246 @@ bool DFRobotDFPlayerMini2::begin(Stream &stream, bool isACK, bool doReset){
     _handleType = DFPlayerCardOnline;
   }
 
-  pl_mode_curr_track = 1;
-  pl_mode_curr_folder = 1;
-  playlist_mode = false;
-  pl_mode_pausing = false;
-  pl_mode_halted = false;
-  pl_mode_announcing = false;
+  resetDutyCycle();
+  _bootTime = millis() - _beginStart;
+  
+  uint8_t type = readType();
+  return (type == DFPlayerCardOnline) || (type == DFPlayerUSBOnline) || (type == DFPlayerCardUSBOnline) || !isACK;
+}
+
+#ifdef DFPLAYER_BEGIN_ASYNC
+bool DFRobotDFPlayerMini2Core::beginAsync(Stream &stream, bool isACK){
+  _serial = &stream;
+  _beginOnline = false;
+  _beginStart = millis();
+  _beginTimer = _beginStart;
+  
+  if (isACK) {
+    enableACK();
+  }
+  else{
+    disableACK();
+  }
+  
+  resetDutyCycle();
+  
+  //a module that is already running answers the status query within a few ms,
+  //in that case the reset (and its ~2 s boot) can be skipped.
+  _beginState = DFPLAYER_BEGIN_PROBE;
+  sendStack(0x42);
+  return true;
+}
+
+void DFRobotDFPlayerMini2Core::beginUpdate(){
+  if (available()) {
+    switch (_beginState) {
+      case DFPLAYER_BEGIN_PROBE:
+        if (_handleCommand == 0x42 && _handleType == DFPlayerFeedBack) {
+          readType();
+          _isSending = false;
+          _beginOnline = true;
+          beginFinish();
+          return;
+        }
+        break;
+      case DFPLAYER_BEGIN_RESET:
+        if (_handleType == DFPlayerCardOnline || _handleType == DFPlayerUSBOnline || _handleType == DFPlayerCardUSBOnline) {
+          readType();  //the online frame belongs to the start-up, not to the next query
+          _beginOnline = true;
+          _beginState = DFPLAYER_BEGIN_SETTLE;
+          _beginTimer = millis();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  
+  switch (_beginState) {
+    case DFPLAYER_BEGIN_PROBE:
+      if (millis() - _beginTimer > DFPLAYER_BEGIN_PROBE_TIME) {
+        //no answer: cold module, fall back to reset and wait for the online frame.
+        _isSending = false;
+        _beginState = DFPLAYER_BEGIN_RESET;
+        _beginTimer = millis();
+        reset();
+      }
+      break;
+    case DFPLAYER_BEGIN_RESET:
+      if (millis() - _beginTimer > DFPLAYER_BEGIN_RESET_TIME) {
+        _beginState = DFPLAYER_BEGIN_SETTLE;
+        _beginTimer = millis();
+      }
+      break;
+    case DFPLAYER_BEGIN_SETTLE:
+      if (millis() - _beginTimer > DFPLAYER_BEGIN_SETTLE_TIME) {
+        beginFinish();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void DFRobotDFPlayerMini2Core::beginFinish(){
+  _beginState = DFPLAYER_BEGIN_DONE;
+  _bootTime = millis() - _beginStart;
+#ifdef _DEBUG
+  Serial.print(F("Boot time: "));
+  Serial.print(_bootTime);
+  Serial.println(F(" ms"));
+#endif
+  if (_readyCallback) {
+    _readyCallback(_beginOnline || !_sending[Stack_ACK]);
+  }
+}
+
+void DFRobotDFPlayerMini2Core::setReadyCallback(void (*callback)(bool online)){
+  _readyCallback = callback;
+}
+#endif
+
+bool DFRobotDFPlayerMini2Core::isReady(){
+#ifdef DFPLAYER_BEGIN_ASYNC
+  return _beginState == DFPLAYER_BEGIN_DONE;
+#else
+  return true;
+#endif
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readBootTime(){
+  return _bootTime;
+}
+
+void DFRobotDFPlayerMini2Core::update(){
+  serviceTrigger();
+  flushSendQueue();
+  
+#ifdef DFPLAYER_TRIGGER
+  if (_triggerBusyPending) {
+    read_play_status_from_pin();
+  }
+#endif
+  
+#ifdef DFPLAYER_BEGIN_ASYNC
+  if (_beginState != DFPLAYER_BEGIN_DONE) {
+    beginUpdate();
+    return;
+  }
+#endif
+  
+#ifdef DFPLAYER_HEALTH_MONITOR
+  if (_healthInterval) {
+    healthUpdate();
+  }
+#endif
   
-  return (readType() == DFPlayerCardOnline) || (readType() == DFPlayerUSBOnline) || !isACK;
+#ifdef DFPLAYER_FADE
+  fadeUpdate();
+#endif
+  
+#ifdef DFPLAYER_AUTO_SLEEP
+  if (_autoSleepTime && !_moduleSleeping && !_isSending && millis() - _lastActivity > _autoSleepTime && !read_play_status_from_pin()) {
+    sleep();
+  }
+#endif
+}
+
+#ifdef DFPLAYER_TRACE
+void DFRobotDFPlayerMini2Core::trace(uint8_t type, uint8_t command, uint16_t parameter){
+  TraceEntry &entry = _trace[(_traceHead + _traceCount) % DFPLAYER_TRACE_LENGTH];
+  entry.time = micros();
+  entry.type = type;
+  entry.command = command;
+  entry.parameter = parameter;
+  if (_traceCount < DFPLAYER_TRACE_LENGTH) {
+    _traceCount++;
+  }
+  else{
+    _traceHead = (_traceHead + 1) % DFPLAYER_TRACE_LENGTH;  //overwrite the oldest entry
+  }
+}
+
+void DFRobotDFPlayerMini2Core::traceRejected(uint8_t *bytes, uint8_t length){
+  //byte 0 is always the 0x7E header, the others go into the parameters of as many entries as needed
+  trace(DFPLAYER_TRACE_RX_ERROR, length, (length > 1 ? bytes[1] << 8 : 0) | (length > 2 ? bytes[2] : 0));
+  for (uint8_t i=3; i<length; i+=3) {
+    trace(DFPLAYER_TRACE_RX_DATA, bytes[i], (i+1 < length ? bytes[i+1] << 8 : 0) | (i+2 < length ? bytes[i+2] : 0));
+  }
 }
 
-uint8_t DFRobotDFPlayerMini2::readType(){
+void DFRobotDFPlayerMini2Core::dumpTrace(Print &out){
+  //header: "DFTR", format version, entry count (little endian), followed by
+  //8 byte entries: time in us (little endian), type, command, parameter (big endian as on the wire)
+  uint8_t header[7] = {'D', 'F', 'T', 'R', 2, (uint8_t)_traceCount, (uint8_t)(_traceCount >> 8)};
+  out.write(header, sizeof(header));
+  for (uint16_t i=0; i<_traceCount; i++) {
+    TraceEntry &entry = _trace[(_traceHead + i) % DFPLAYER_TRACE_LENGTH];
+    uint8_t record[8] = {(uint8_t)entry.time, (uint8_t)(entry.time >> 8), (uint8_t)(entry.time >> 16), (uint8_t)(entry.time >> 24),
+                         entry.type, entry.command, (uint8_t)(entry.parameter >> 8), (uint8_t)entry.parameter};
+    out.write(record, sizeof(record));
+  }
+  clearTrace();
+}
+
+void DFRobotDFPlayerMini2Core::clearTrace(){
+  _traceHead = 0;
+  _traceCount = 0;
+}
+#endif
+
+uint8_t DFRobotDFPlayerMini2Core::readType(){
   _isAvailable = false;
   return _handleType;
 }
 
-uint16_t DFRobotDFPlayerMini2::read(){
+uint16_t DFRobotDFPlayerMini2Core::read(){
   _isAvailable = false;
   return _handleParameter;
 }
 
-bool DFRobotDFPlayerMini2::handleMessage(uint8_t type, uint16_t parameter){
-  _receivedIndex = 0;
+bool DFRobotDFPlayerMini2Core::handleMessage(uint8_t type, uint16_t parameter){
   _handleType = type;
   _handleParameter = parameter;
   _isAvailable = true;
   return _isAvailable;
 }
 
-bool DFRobotDFPlayerMini2::handleError(uint8_t type, uint16_t parameter){
+bool DFRobotDFPlayerMini2Core::handleError(uint8_t type, uint16_t parameter){
   handleMessage(type, parameter);
   _isSending = false;
   return false;
 }
 
-uint8_t DFRobotDFPlayerMini2::readCommand(){
+uint8_t DFRobotDFPlayerMini2Core::readCommand(){
   _isAvailable = false;
   return _handleCommand;
 }
 
-void DFRobotDFPlayerMini2::parseStack(){
-  uint8_t handleCommand = *(_received + Stack_Command);
+void DFRobotDFPlayerMini2Core::parseStack(uint8_t *frame){
+  uint8_t handleCommand = *(frame + Stack_Command);
   if (handleCommand == 0x41) { //handle the 0x41 ack feedback as a spcecial case, in case the pollusion of _handleCommand, _handleParameter, and _handleType.
     _isSending = false;
     return;
   }
   
   _handleCommand = handleCommand;
-  _handleParameter =  arrayToUint16(_received + Stack_Parameter);
+  _handleParameter =  arrayToUint16(frame + Stack_Parameter);
 
   switch (_handleCommand) {
     case 0x3D:
       handleMessage(DFPlayerPlayFinished, _handleParameter);
       break;
     case 0x3F:
-      if (_handleParameter & 0x01) {
+      if ((_handleParameter & 0x03) == 0x03) {
+        handleMessage(DFPlayerCardUSBOnline, _handleParameter);
+      }
+      else if (_handleParameter & 0x01) {
         handleMessage(DFPlayerUSBOnline, _handleParameter);
       }
       else if (_handleParameter & 0x02) {
         handleMessage(DFPlayerCardOnline, _handleParameter);
       }
-      else if (_handleParameter & 0x03) {
-        handleMessage(DFPlayerCardUSBOnline, _handleParameter);
-      }
       break;
     case 0x3A:
       if (_handleParameter & 0x01) {
@@ -197,6 +625,7 @@ void DFRobotDFPlayerMini2::parseStack(){
       break;
     case 0x40:
       handleMessage(DFPlayerError, _handleParameter);
+      _isSending = false;  //the error frame answers the failed command
       break;
     case 0x3C:
     case 0x3E:
@@ -221,222 +650,723 @@ void DFRobotDFPlayerMini2::parseStack(){
   }
 }
 
-uint16_t DFRobotDFPlayerMini2::arrayToUint16(uint8_t *array){
+uint16_t DFRobotDFPlayerMini2Core::arrayToUint16(uint8_t *array){
   uint16_t value = *array;
   value <<=8;
   value += *(array+1);
   return value;
 }
 
-bool DFRobotDFPlayerMini2::validateStack(){
+bool DFRobotDFPlayerMini2Core::validateStack(){
   return calculateCheckSum(_received) == arrayToUint16(_received+Stack_CheckSum);
 }
 
-bool DFRobotDFPlayerMini2::available(){
-  while (_serial->available()) {
-    delay(0);
-    if (_receivedIndex == 0) {
-      _received[Stack_Header] = _serial->read();
+bool DFRobotDFPlayerMini2Core::checkByte(uint8_t index, uint8_t value){
+  switch (index) {
+    case Stack_Header:
+      return value == 0x7E;
+    case Stack_Version:
+      return value == 0xFF;
+    case Stack_Length:
+      return value == 0x06;
+    case Stack_End:
+      return value == 0xEF;
+    default:
+      return true;
+  }
+}
+
+void DFRobotDFPlayerMini2Core::resync(){
+  //the rejected bytes may contain the start of the next frame (e.g. a frame that began
+  //inside a truncated one), continue with the first header that forms a valid prefix.
+  uint8_t length = _receivedIndex + 1;
+  _receivedIndex = 0;
+  for (uint8_t i=1; i<length; i++) {
+    if (_received[i] != 0x7E) {
+      continue;
+    }
+    uint8_t j = 1;
+    while (i + j < length && checkByte(j, _received[i + j])) {
+      j++;
+    }
+    if (i + j == length) {
+      memmove(_received, _received + i, j);
+      _receivedIndex = j;
+      return;
+    }
+  }
+}
+
+uint8_t DFRobotDFPlayerMini2Core::parseByte(uint8_t value){
 #ifdef _DEBUG
-      Serial.print(F("received:"));
-      Serial.print(_received[_receivedIndex],HEX);
-      Serial.print(F(" "));
+  if (_receivedIndex == 0 && value == 0x7E) {
+    Serial.print(F("received:"));
+  }
+  Serial.print(value,HEX);
+  Serial.print(F(" "));
 #endif
-      if (_received[Stack_Header] == 0x7E) {
-        _receivedIndex ++;
-      }
+  if (_receivedIndex == 0) {
+    if (value == 0x7E) {
+      _received[Stack_Header] = value;
+      _receivedIndex ++;
     }
-    else{
-      _received[_receivedIndex] = _serial->read();
+    return DFPLAYER_PARSE_PENDING;
+  }
+  
+  _received[_receivedIndex] = value;
+  if (checkByte(_receivedIndex, value) && (_receivedIndex != Stack_End || validateStack())) {
+    if (_receivedIndex == Stack_End) {
 #ifdef _DEBUG
-      Serial.print(_received[_receivedIndex],HEX);
-      Serial.print(F(" "));
+      Serial.println();
 #endif
-      switch (_receivedIndex) {
-        case Stack_Version:
-          if (_received[_receivedIndex] != 0xFF) {
-            return handleError(WrongStack);
-          }
+#ifdef DFPLAYER_TRACE
+      trace(DFPLAYER_TRACE_RX, _received[Stack_Command], arrayToUint16(_received+Stack_Parameter));
+#endif
+      _receivedIndex = 0;
+      return DFPLAYER_PARSE_COMPLETE;
+    }
+    _receivedIndex++;
+    return DFPLAYER_PARSE_PENDING;
+  }
+  
+#ifdef DFPLAYER_TRACE
+  uint8_t rejected[DFPLAYER_RECEIVED_LENGTH];
+  uint8_t length = _receivedIndex + 1;
+  memcpy(rejected, _received, length);
+#endif
+  resync();
+#ifdef DFPLAYER_TRACE
+  //the bytes kept by resync() are traced with the frame they start
+  traceRejected(rejected, length - _receivedIndex);
+#endif
+  return DFPLAYER_PARSE_ERROR;
+}
+
+#ifdef DFPLAYER_FRAME_QUEUE
+void DFRobotDFPlayerMini2Core::setReceiveMode(uint8_t mode){
+  _receiveMode = mode;
+}
+
+void DFRobotDFPlayerMini2Core::receive(){
+  if (_receiveMode == DFPLAYER_RECEIVE_EVENT) {
+    receiveFrames();
+  }
+}
+#endif
+
+void DFRobotDFPlayerMini2Core::pollFrames(){
+  //parses the pending input for update(), so that errors and the health state are
+  //seen when the sketch does not call available()
+#ifdef DFPLAYER_FRAME_QUEUE
+  receiveFrames();
+#else
+  //without the frame queue only the last message stays readable
+  while (_serial->available()) {
+    available();
+  }
+#endif
+}
+
+uint16_t DFRobotDFPlayerMini2Core::takeError(){
+  noInterrupts();
+  uint16_t error = _errorPending;
+  _errorPending = 0;
+  interrupts();
+  return error;
+}
+
+#ifdef DFPLAYER_FRAME_QUEUE
+void DFRobotDFPlayerMini2Core::receiveFrames(){
+  //may be called from an interrupt and from available() or healthUpdate(); the one
+  //that comes second leaves the bytes to the first
+  noInterrupts();
+  if (_receiving) {
+    interrupts();
+    return;
+  }
+  _receiving = true;
+  interrupts();
+  
+  while (_serial->available()) {
+    switch (parseByte(_serial->read())) {
+      case DFPLAYER_PARSE_COMPLETE: {
+        if (checkFrame(_received)) {
           break;
-        case Stack_Length:
-          if (_received[_receivedIndex] != 0x06) {
-            return handleError(WrongStack);
-          }
+        }
+        uint8_t tail = _frameQueueTail;
+        uint8_t next = (tail + 1) % DFPLAYER_FRAME_QUEUE_LENGTH;
+        if (next == _frameQueueHead) {
+          _droppedFrames++;
           break;
-        case Stack_End:
+        }
+        for (uint8_t i = 0; i < DFPLAYER_RECEIVED_LENGTH; i++) {
+          _frameQueue[tail][i] = _received[i];
+        }
+        _frameQueueTail = next;
+        break;
+      }
+      case DFPLAYER_PARSE_ERROR:
+        _receiveErrors++;
+        break;
+      default:
+        break;
+    }
+  }
+  _receiving = false;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readDroppedFrames(){
+  noInterrupts();
+  unsigned long dropped = _droppedFrames;
+  interrupts();
+  return dropped;
+}
+#endif
+
+void DFRobotDFPlayerMini2Core::shadowCommand(uint8_t command, uint16_t argument){
+#ifdef DFPLAYER_FADE
+  if (command >= 0x04 && command <= 0x06) {
+    finishFade();  //user volume commands take over from a fade
+  }
+#endif
+  switch (command) {
+    case 0x04:
+      if (_shadowVolume < 30) {
+        _shadowVolume++;
+      }
+      break;
+    case 0x05:
+      if (_shadowVolume != 0xFF && _shadowVolume > 0) {
+        _shadowVolume--;
+      }
+      break;
+    case 0x06:
+      _shadowVolume = argument;
+      break;
+#ifdef DFPLAYER_HEALTH_MONITOR
+    case 0x07:
+      _shadowEQ = argument;
+      break;
+    case 0x0D:
+      _shadowPaused = false;
+      break;
+    case 0x0E:
+      _shadowPaused = true;
+      break;
+    case 0x0C:
+    case 0x16:
+      _shadowPlayCommand = 0;
+      break;
+    case 0x03:
+    case 0x08:
+    case 0x0F:
+    case 0x12:
+    case 0x14:
+    case 0x17:
+    case 0x18:
+      _shadowPlayCommand = command;
+      _shadowPlayParameter = argument;
+      _shadowPaused = false;
+      break;
+#endif
+    default:
+      break;
+  }
+}
+
+#ifdef DFPLAYER_HEALTH_MONITOR
+void DFRobotDFPlayerMini2Core::enableHealthMonitor(unsigned long interval, uint8_t failures){
+  _healthInterval = interval;
+  _healthThreshold = failures;
+  _healthFailures = 0;
+  _healthLastAlive = millis();
+}
+
+void DFRobotDFPlayerMini2Core::disableHealthMonitor(){
+  _healthInterval = 0;
+  _healthState = DFPLAYER_HEALTH_IDLE;
+  _healthProbePending = false;
+}
+
+bool DFRobotDFPlayerMini2Core::isRestarting(){
+  return _healthState >= DFPLAYER_HEALTH_RESET;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readProbeLatency(){
+  return _healthLatency;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readProbeLatencyDrift(){
+  return (_healthLatency > _healthLatencyMin) ? _healthLatency - _healthLatencyMin : 0;
+}
+
+unsigned int DFRobotDFPlayerMini2Core::readHealthResets(){
+  return _healthResets;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readDetectionTime(){
+  return _healthDetectionTime;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readRestartTime(){
+  return _healthRestartTime;
+}
+#endif
+
+#ifdef DFPLAYER_FADE
+void DFRobotDFPlayerMini2Core::fadeVolume(uint8_t target, unsigned long duration, uint8_t curve){
+  if (target > 30) {
+    target = 30;
+  }
+  if (_shadowVolume == 0xFF) {
+    int current = readVolume();
+    _shadowVolume = (current >= 0 && current <= 30) ? current : 0;
+  }
+  
+  _fadeFrom = _shadowVolume;
+  _fadeLevel = _shadowVolume;
+  _fadeTo = target;
+  _fadeCurve = curve;
+  _fadeDuration = duration;
+  _fadeStart = millis();
+  _fadeLastStep = micros();
+  _fadeEndCommand = 0;
+  _fadeSteps = 0;
+  _fadeMaxJump = 0;
+  _fadeMaxInterval = 0;
+  _fading = true;
+  fadeUpdate();
+}
+
+bool DFRobotDFPlayerMini2Core::isFading(){
+  return _fading;
+}
+
+void DFRobotDFPlayerMini2Core::stopFade(){
+  _fading = false;
+  _fadeEndCommand = 0;
+}
+
+unsigned int DFRobotDFPlayerMini2Core::readFadeSteps(){
+  return _fadeSteps;
+}
+
+uint8_t DFRobotDFPlayerMini2Core::readFadeMaxJump(){
+  return _fadeMaxJump;
+}
+
+unsigned long DFRobotDFPlayerMini2Core::readFadeMaxInterval(){
+  return _fadeMaxInterval;
+}
+
+void DFRobotDFPlayerMini2Core::fadeUpdate(){
+  if (!_fading) {
+    return;
+  }
+  if (_moduleSleeping) {
+    stopFade();
+    return;
+  }
+  
+  //the level follows the clock, steps the line has no room for are skipped
+  unsigned long elapsed = millis() - _fadeStart;
+  uint8_t level = _fadeTo;
+  if (elapsed < _fadeDuration) {
+    unsigned long fraction = (unsigned long long)elapsed * 256 / _fadeDuration;
+    if (_fadeCurve == DFPLAYER_FADE_EASE_IN) {
+      fraction = fraction * fraction / 256;
+    }
+    else if (_fadeCurve == DFPLAYER_FADE_EASE_OUT) {
+      fraction = 256 - (256 - fraction) * (256 - fraction) / 256;
+    }
+    level = _fadeFrom + ((int)_fadeTo - _fadeFrom) * (long)fraction / 256;
+  }
+  
+  if (level != _fadeLevel && _isSending) {
+    //an ACK nobody reads would stall the fade (e.g. in pl_mode_fade_out()): parse
+    //the input, frames for the sketch wait in the frame queue, and give up on the
+    //ACK after the time out
+    receiveFrames();
+    if (_isSending && millis() - _timeOutTimer >= _timeOutDuration) {
+      _isSending = false;
+#ifdef DFPLAYER_HEALTH_MONITOR
+      _healthFailures++;
+#endif
+    }
+  }
+  
+  if (level != _fadeLevel) {
+    //lower priority than user commands: only on a free line
+    unsigned long now = micros();
+    if (_isSending || sendPending() || now - _fadeLastStep < DFPLAYER_FADE_INTERVAL || now - _lastWrite < DFPLAYER_SEND_INTERVAL) {
+      return;
+    }
+    writeFrame(0x06, level);
+    uint8_t jump = (level > _fadeLevel) ? level - _fadeLevel : _fadeLevel - level;
+    if (jump > _fadeMaxJump) {
+      _fadeMaxJump = jump;
+    }
+    if (_fadeSteps && (_lastWrite - _fadeLastStep) / 1000 > _fadeMaxInterval) {
+      _fadeMaxInterval = (_lastWrite - _fadeLastStep) / 1000;
+    }
+    _fadeSteps++;
+    _fadeLastStep = _lastWrite;
+    _fadeLevel = level;
+    _shadowVolume = level;
+#ifdef DFPLAYER_AUTO_SLEEP
+    _lastActivity = millis();
+#endif
+  }
+  
+  if (elapsed >= _fadeDuration && level == _fadeLevel) {
+    finishFade();
+  }
+}
+
+void DFRobotDFPlayerMini2Core::finishFade(){
+  //runs from idle() and from sendStack() via shadowCommand(), so the end command is
+  //written directly instead of through sendStack() and its _sending buffer
+  _fading = false;
+  uint8_t command = _fadeEndCommand;
+  if (command) {
+    _fadeEndCommand = 0;
+    writeFrame(command, 0);
+    shadowCommand(command, 0);
+#ifdef DFPLAYER_AUTO_SLEEP
+    _lastActivity = millis();
+#endif
+  }
+}
+#endif
+
+bool DFRobotDFPlayerMini2Core::checkFrame(uint8_t *frame){
+  //every frame shows that the module is alive. ACKs and probe answers are consumed
+  //here, so that they arrive even if the sketch leaves a message unread (without
+  //DFPLAYER_HEALTH_MONITOR only the ACKs).
+#ifdef DFPLAYER_HEALTH_MONITOR
+  _healthLastAlive = millis();
+  _healthFailures = 0;
+#endif
+  switch (frame[Stack_Command]) {
+    case 0x41:
+      _isSending = false;
+      return true;
+    case 0x40:
+      //marked for recovery here, so that update() sees it even if the frame waits
+      //in the frame queue. Recovery replays _lastCommand; an error answering a
+      //query (e.g. a folder that does not exist) or a direct write is only reported.
+      if (_lastTracked) {
+        _errorPending = arrayToUint16(frame+Stack_Parameter);
+      }
+      return false;
+#ifdef DFPLAYER_HEALTH_MONITOR
+    case 0x3F:
+      //the online frame after a reset of the monitor answers nothing the sketch
+      //asked for; queued, it would be read as the answer of the next query
+      _healthOnline = true;
+      return _healthState >= DFPLAYER_HEALTH_RESET;
+    case 0x42:
+      if (_healthProbePending) {
+        unsigned long latency = micros() - _healthProbeTime;
+        _healthProbePending = false;
+        _healthLatency = _healthLatency ? _healthLatency - _healthLatency / 8 + latency / 8 : latency;
+        if (!_healthLatencyMin || latency < _healthLatencyMin) {
+          _healthLatencyMin = latency;
+        }
+        return true;
+      }
+      return false;
+#endif
+    default:
+      return false;
+  }
+}
+
+#ifdef DFPLAYER_HEALTH_MONITOR
+void DFRobotDFPlayerMini2Core::healthUpdate(){
+  //the monitor parses the input itself (frames for the sketch wait in the frame
+  //queue) and runs the ACK timeout, so it works when the sketch does not call
+  //available() or has a message it has not read yet
+  receiveFrames();
+  if (_isSending && millis() - _timeOutTimer >= _timeOutDuration) {
+    if (_isAvailable) {
+      _isSending = false;
+      _healthFailures++;
+    }
+    else{
+      available();  //reports the TimeOut
+    }
+  }
+  
+  switch (_healthState) {
+    case DFPLAYER_HEALTH_IDLE:
+      if (_healthFailures >= _healthThreshold) {
+        _healthDetect = millis();
+        _healthDetectionTime = _healthDetect - _healthLastAlive;
+        _healthResets++;
 #ifdef _DEBUG
-          Serial.println();
+        Serial.println(F("Health: module not responding, reset"));
 #endif
-          if (_received[_receivedIndex] != 0xEF) {
-            return handleError(WrongStack);
-          }
-          else{
-            if (validateStack()) {
-              _receivedIndex = 0;
-              parseStack();
-              return _isAvailable;
-            }
-            else{
-              return handleError(WrongStack);
-            }
-          }
-          break;
-        default:
-          break;
+        _healthOnline = false;
+        _healthState = DFPLAYER_HEALTH_RESET;
+        _healthTimer = millis();
+        _isSending = false;
+#ifdef DFPLAYER_SEND_QUEUE
+        _sendQueueCount = 0;
+#endif
+        writeFrame(0x0C, 0);
+        _moduleSleeping = false;
+      }
+      //probe only while the line is idle, so user commands never wait for a probe
+      else if (!_moduleSleeping && !_isSending && !sendPending() && millis() - _healthLastAlive >= _healthInterval
+               && micros() - _lastWrite >= DFPLAYER_SEND_INTERVAL) {
+        writeFrame(0x42, 0);
+        _healthProbeTime = _lastWrite;
+        _healthProbePending = true;
+        _healthState = DFPLAYER_HEALTH_PROBE;
+        _healthTimer = millis();
+      }
+      break;
+    case DFPLAYER_HEALTH_PROBE:
+      if (!_healthProbePending) {
+        _healthState = DFPLAYER_HEALTH_IDLE;
+      }
+      else if (millis() - _healthTimer >= _timeOutDuration) {
+        _healthProbePending = false;
+        _healthState = DFPLAYER_HEALTH_IDLE;
+        _healthFailures++;
+      }
+      break;
+    case DFPLAYER_HEALTH_RESET:
+      if (_healthOnline) {
+        _healthState = DFPLAYER_HEALTH_SETTLE;
+        _healthTimer = millis();
+      }
+      else if (millis() - _healthTimer > DFPLAYER_BEGIN_RESET_TIME) {
+        _healthTimer = millis();
+        writeFrame(0x0C, 0);
+      }
+      break;
+    case DFPLAYER_HEALTH_SETTLE:
+      if (millis() - _healthTimer > DFPLAYER_BEGIN_SETTLE_TIME) {
+        if (device != DFPLAYER_DEVICE_SD) {
+          sendStack(0x09, device);
+        }
+        _healthState = DFPLAYER_HEALTH_RESTORE;
+        _healthTimer = millis();
       }
-      _receivedIndex++;
+      break;
+    case DFPLAYER_HEALTH_RESTORE:
+      if (millis() - _healthTimer > DFPLAYER_BEGIN_SETTLE_TIME) {
+        if (_shadowVolume != 0xFF) {
+          sendStack(0x06, _shadowVolume);
+        }
+        if (_shadowEQ != DFPLAYER_EQ_NORMAL) {
+          sendStack(0x07, _shadowEQ);
+        }
+        if (_shadowPlayCommand && !_shadowPaused) {
+          sendStack(_shadowPlayCommand, _shadowPlayParameter);
+        }
+        _healthFailures = 0;
+        _healthLastAlive = millis();
+        _healthRestartTime = millis() - _healthDetect;
+        _healthState = DFPLAYER_HEALTH_IDLE;
+#ifdef _DEBUG
+        Serial.print(F("Health: restored after "));
+        Serial.print(_healthRestartTime);
+        Serial.println(F(" ms"));
+#endif
+      }
+      break;
+    default:
+      break;
+  }
+}
+#endif
+
+bool DFRobotDFPlayerMini2Core::available(){
+  serviceTrigger();
+  flushSendQueue();
+  
+#ifdef DFPLAYER_FRAME_QUEUE
+  if (_receiveMode == DFPLAYER_RECEIVE_EVENT) {
+    receive();  //serialEvent() does not run during blocking calls
+  }
+  //errors of receiveFrames(), in polling mode it is run by the health monitor
+  if (_receiveErrors != _receiveErrorsHandled) {
+    _receiveErrorsHandled = _receiveErrors;
+    return handleError(WrongStack);
+  }
+  
+  //frames queued by receiveFrames(); also drained after switching back to polling
+  uint8_t head = _frameQueueHead;
+  if (head != _frameQueueTail) {
+    uint8_t frame[DFPLAYER_RECEIVED_LENGTH];
+    for (uint8_t i = 0; i < DFPLAYER_RECEIVED_LENGTH; i++) {
+      frame[i] = _frameQueue[head][i];
+    }
+    _frameQueueHead = (head + 1) % DFPLAYER_FRAME_QUEUE_LENGTH;
+    parseStack(frame);
+    return _isAvailable;
+  }
+  
+  while (_receiveMode == DFPLAYER_RECEIVE_POLL && _serial->available()) {
+#else
+  while (_serial->available()) {
+#endif
+    delay(0);
+    switch (parseByte(_serial->read())) {
+      case DFPLAYER_PARSE_COMPLETE:
+        if (checkFrame(_received)) {
+          break;
+        }
+        parseStack(_received);
+        return _isAvailable;
+      case DFPLAYER_PARSE_ERROR:
+        return handleError(WrongStack);
+      default:
+        break;
     }
   }
   
   if (_isSending && (millis()-_timeOutTimer>=_timeOutDuration)) {
+#ifdef DFPLAYER_HEALTH_MONITOR
+    _healthFailures++;
+#endif
     return handleError(TimeOut);
   }
   
   return _isAvailable;
 }
 
-void DFRobotDFPlayerMini2::next(){
+void DFRobotDFPlayerMini2Core::next(){
   sendStack(0x01);
 }
 
-void DFRobotDFPlayerMini2::previous(){
+void DFRobotDFPlayerMini2Core::previous(){
   sendStack(0x02);
 }
 
-void DFRobotDFPlayerMini2::play(int fileNumber){
+void DFRobotDFPlayerMini2Core::play(int fileNumber){
   sendStack(0x03, fileNumber);
 }
 
-void DFRobotDFPlayerMini2::volumeUp(){
+void DFRobotDFPlayerMini2Core::volumeUp(){
   sendStack(0x04);
 }
 
-void DFRobotDFPlayerMini2::volumeDown(){
+void DFRobotDFPlayerMini2Core::volumeDown(){
   sendStack(0x05);
 }
 
-void DFRobotDFPlayerMini2::volume(uint8_t volume){
+void DFRobotDFPlayerMini2Core::volume(uint8_t volume){
   sendStack(0x06, volume);
 }
 
-void DFRobotDFPlayerMini2::EQ(uint8_t eq) {
+void DFRobotDFPlayerMini2Core::EQ(uint8_t eq) {
   sendStack(0x07, eq);
 }
 
-void DFRobotDFPlayerMini2::loop(int fileNumber) {
+void DFRobotDFPlayerMini2Core::loop(int fileNumber) {
   sendStack(0x08, fileNumber);
 }
 
-void DFRobotDFPlayerMini2::outputDevice(uint8_t device) {
+void DFRobotDFPlayerMini2Core::outputDevice(uint8_t device) {
   sendStack(0x09, device);
-  delay(200);
+  _moduleSleeping = (device == DFPLAYER_DEVICE_SLEEP);
+  if (!_moduleSleeping) {
+    this->device = device;
+  }
+  _deviceSwitching = true;
+  _deviceSwitchTimer = millis();
+}
+
+bool DFRobotDFPlayerMini2Core::isSwitchingDevice(){
+  if (_deviceSwitching && millis() - _deviceSwitchTimer >= DFPLAYER_DEVICE_SWITCH_TIME) {
+    _deviceSwitching = false;
+  }
+  return _deviceSwitching;
 }
 
-void DFRobotDFPlayerMini2::sleep(){
+void DFRobotDFPlayerMini2Core::sleep(){
   sendStack(0x0A);
+  _moduleSleeping = true;
 }
 
-void DFRobotDFPlayerMini2::reset(){
+void DFRobotDFPlayerMini2Core::reset(){
   sendStack(0x0C);
+  _moduleSleeping = false;
 }
 
-void DFRobotDFPlayerMini2::start(){
+void DFRobotDFPlayerMini2Core::start(){
   sendStack(0x0D);
 }
 
-void DFRobotDFPlayerMini2::pause(){
+void DFRobotDFPlayerMini2Core::pause(){
   sendStack(0x0E);
 }
 
-void DFRobotDFPlayerMini2::playFolder(uint8_t folderNumber, uint8_t fileNumber){
+void DFRobotDFPlayerMini2Core::playFolder(uint8_t folderNumber, uint8_t fileNumber){
   sendStack(0x0F, folderNumber, fileNumber);
 }
 
-void DFRobotDFPlayerMini2::outputSetting(bool enable, uint8_t gain){
+void DFRobotDFPlayerMini2Core::outputSetting(bool enable, uint8_t gain){
   sendStack(0x10, enable, gain);
 }
 
-void DFRobotDFPlayerMini2::enableLoopAll(){
+void DFRobotDFPlayerMini2Core::enableLoopAll(){
   sendStack(0x11, 0x01);
 }
 
-void DFRobotDFPlayerMini2::disableLoopAll(){
+void DFRobotDFPlayerMini2Core::disableLoopAll(){
   sendStack(0x11, 0x00);
 }
 
-void DFRobotDFPlayerMini2::playMp3Folder(int fileNumber){
+void DFRobotDFPlayerMini2Core::playMp3Folder(int fileNumber){
   sendStack(0x12, fileNumber);
 }
 
-void DFRobotDFPlayerMini2::advertise(int fileNumber){
-  bool prev = read_play_status_from_pin();
-  bool curr;
-
+void DFRobotDFPlayerMini2Core::advertise(int fileNumber){
   sendStack(0x13, fileNumber);
-
-  if (playlist_mode) {
-    byte transition_counter = 0;
-    while (transition_counter < 4) {
-      curr = read_play_status_from_pin();
-      if (prev != curr) {
-        transition_counter++;
-        prev = curr;
-      }
-    }
-  }
-  /*unsigned long timex = millis();
-  while (millis()-timex < 2000) {
-    curr = read_play_status_from_pin();
-    if (prev != curr) {
-      Serial.print("Play status transistion: ");
-      Serial.print(prev);
-      Serial.print(" -> ");
-      Serial.print(curr);
-      Serial.print(" after ");
-      Serial.print(millis()-timex);
-      Serial.println(" ms");
-      prev = curr;
-    }
-  }*/
 }
 
-void DFRobotDFPlayerMini2::playLargeFolder(uint8_t folderNumber, uint16_t fileNumber){
+void DFRobotDFPlayerMini2Core::playLargeFolder(uint8_t folderNumber, uint16_t fileNumber){
   sendStack(0x14, (((uint16_t)folderNumber) << 12) | fileNumber);
 }
 
-void DFRobotDFPlayerMini2::stopAdvertise(){
+void DFRobotDFPlayerMini2Core::stopAdvertise(){
   sendStack(0x15);
 }
 
-void DFRobotDFPlayerMini2::stop(){
+void DFRobotDFPlayerMini2Core::stop(){
   sendStack(0x16);
 }
 
-void DFRobotDFPlayerMini2::loopFolder(int folderNumber){
+void DFRobotDFPlayerMini2Core::loopFolder(int folderNumber){
   sendStack(0x17, folderNumber);
 }
 
-void DFRobotDFPlayerMini2::randomAll(){
+void DFRobotDFPlayerMini2Core::randomAll(){
   sendStack(0x18);
 }
 
-void DFRobotDFPlayerMini2::enableLoop(){
+void DFRobotDFPlayerMini2Core::enableLoop(){
   sendStack(0x19, 0x00);
 }
 
-void DFRobotDFPlayerMini2::disableLoop(){
+void DFRobotDFPlayerMini2Core::disableLoop(){
   sendStack(0x19, 0x01);
 }
 
-void DFRobotDFPlayerMini2::enableDAC(){
+void DFRobotDFPlayerMini2Core::enableDAC(){
   sendStack(0x1A, 0x00);
 }
 
-void DFRobotDFPlayerMini2::disableDAC(){
+void DFRobotDFPlayerMini2Core::disableDAC(){
   sendStack(0x1A, 0x01);
 }
 
-int DFRobotDFPlayerMini2::readState(){
+int DFRobotDFPlayerMini2Core::readState(){
   sendStack(0x42);
   if (waitAvailable()) {
     if (readType() == DFPlayerFeedBack) {
@@ -451,7 +1381,7 @@ int DFRobotDFPlayerMini2::readState(){
   }
 }
 
-int DFRobotDFPlayerMini2::readVolume(){
+int DFRobotDFPlayerMini2Core::readVolume(){
   sendStack(0x43);
   if (waitAvailable()) {
     return read();
@@ -461,7 +1391,7 @@ int DFRobotDFPlayerMini2::readVolume(){
   }
 }
 
-int DFRobotDFPlayerMini2::readEQ(){
+int DFRobotDFPlayerMini2Core::readEQ(){
   sendStack(0x44);
   if (waitAvailable()) {
     if (readType() == DFPlayerFeedBack) {
@@ -476,7 +1406,7 @@ int DFRobotDFPlayerMini2::readEQ(){
   }
 }
 
-int DFRobotDFPlayerMini2::readFileCounts(uint8_t device){
+int DFRobotDFPlayerMini2Core::readFileCounts(uint8_t device){
   switch (device) {
     case DFPLAYER_DEVICE_U_DISK:
       sendStack(0x47);
@@ -504,7 +1434,7 @@ int DFRobotDFPlayerMini2::readFileCounts(uint8_t device){
   }
 }
 
-int DFRobotDFPlayerMini2::readCurrentFileNumber(uint8_t device){
+int DFRobotDFPlayerMini2Core::readCurrentFileNumber(uint8_t device){
   switch (device) {
     case DFPLAYER_DEVICE_U_DISK:
       sendStack(0x4B);
@@ -531,7 +1461,7 @@ int DFRobotDFPlayerMini2::readCurrentFileNumber(uint8_t device){
   }
 }
 
-int DFRobotDFPlayerMini2::readFileCountsInFolder(int folderNumber){
+int DFRobotDFPlayerMini2Core::readFileCountsInFolder(int folderNumber){
   sendStack(0x4E, folderNumber);
   if (waitAvailable()) {
     if (readType() == DFPlayerFeedBack) {
@@ -546,7 +1476,7 @@ int DFRobotDFPlayerMini2::readFileCountsInFolder(int folderNumber){
   }
 }
 
-int DFRobotDFPlayerMini2::readFolderCounts(){
+int DFRobotDFPlayerMini2Core::readFolderCounts(){
   sendStack(0x4F);
   if (waitAvailable()) {
     if (readType() == DFPlayerFeedBack) {
@@ -561,19 +1491,349 @@ int DFRobotDFPlayerMini2::readFolderCounts(){
   }
 }
 
-int DFRobotDFPlayerMini2::readFileCounts(){
+int DFRobotDFPlayerMini2Core::readFileCounts(){
   return readFileCounts(DFPLAYER_DEVICE_SD);
 }
 
-int DFRobotDFPlayerMini2::readCurrentFileNumber(){
+int DFRobotDFPlayerMini2Core::readCurrentFileNumber(){
   return readCurrentFileNumber(DFPLAYER_DEVICE_SD);
 }
 
+bool DFRobotDFPlayerMini2Core::readSnapshot(DFPlayerSnapshot &snapshot, uint8_t device, unsigned long duration){
+  uint8_t queries[6] = {0x42, 0x43, 0x44, 0x48, 0x4C, 0x4F};
+  int *fields[6] = {&snapshot.state, &snapshot.volume, &snapshot.eq, &snapshot.fileCounts, &snapshot.currentFileNumber, &snapshot.folderCounts};
+  if (device == DFPLAYER_DEVICE_U_DISK) {
+    queries[3] = 0x47;
+    queries[4] = 0x4B;
+  }
+  else if (device == DFPLAYER_DEVICE_FLASH) {
+    queries[3] = 0x49;
+    queries[4] = 0x4D;
+  }
+  
+  snapshot.valid = 0;
+  for (uint8_t i = 0; i < 6; i++) {
+    *fields[i] = -1;
+  }
+  if (!duration) {
+    duration = _timeOutDuration;
+  }
+  
+  //without ACK the queries are only paced by the frame gap instead of waiting for
+  //one round trip each; the deadline includes the time to send them
+  unsigned long timer = millis();
+  uint8_t ack = _sending[Stack_ACK];
+  disableACK();
+  for (uint8_t i = 0; i < 6; i++) {
+    sendStack(queries[i]);
+  }
+  _sending[Stack_ACK] = ack;
+  
+  //every query is answered by its feedback frame or by an error frame
+  uint8_t answers = 0;
+  while (answers < 6 && millis() - timer < duration) {
+    if (!available()) {
+      idle(timer, duration);
+      continue;
+    }
+    uint8_t type = readType();
+    if (type == DFPlayerError) {
+      answers++;
+    }
+    else if (type == DFPlayerFeedBack) {
+      for (uint8_t i = 0; i < 6; i++) {
+        if (_handleCommand == queries[i] && !(snapshot.valid & (1 << i))) {
+          *fields[i] = _handleParameter;
+          snapshot.valid |= 1 << i;
+          answers++;
+          break;
+        }
+      }
+    }
+  }
+  
+  return snapshot.valid == DFPLAYER_SNAPSHOT_ALL;
+}
+
+
+// Playlist engine, folder scan and error recovery, layered on top of the
+// protocol core. A sketch that only needs the core uses DFRobotDFPlayerMini2Core
+// and does not pay for the state below.
+
+bool DFRobotDFPlayerMini2::begin(Stream &stream, bool isACK, bool doReset){
+  initPlaylistState();
+  return DFRobotDFPlayerMini2Core::begin(stream, isACK, doReset);
+}
+
+#ifdef DFPLAYER_BEGIN_ASYNC
+bool DFRobotDFPlayerMini2::beginAsync(Stream &stream, bool isACK){
+  initPlaylistState();
+  return DFRobotDFPlayerMini2Core::beginAsync(stream, isACK);
+}
+#endif
+
+void DFRobotDFPlayerMini2::initPlaylistState(){
+  pl_mode_curr_track = 1;
+  pl_mode_curr_folder = 1;
+  playlist_mode = false;
+  pl_mode_pausing = false;
+  pl_mode_halted = false;
+  pl_mode_announcing = false;
+#ifdef DFPLAYER_FADE
+  pl_mode_faded = false;
+#endif
+}
+
+void DFRobotDFPlayerMini2::update(){
+  DFRobotDFPlayerMini2Core::update();
+  if (!isReady()) {
+    return;
+  }
+  
+  if (recoveryEnabled()) {
+    pollFrames();
+    uint16_t error = takeError();
+    if (error && error < Advertise && _recoveryPolicy[error]) {
+      recoveryStart(error);
+    }
+  }
+  
+  if (_scanState != DFPLAYER_SCAN_IDLE) {
+    scanUpdate();
+  }
+  
+  if (_recoveryState != DFPLAYER_RECOVERY_IDLE) {
+    recoveryUpdate();
+  }
+}
+
+void DFRobotDFPlayerMini2::advertise(int fileNumber){
+  bool prev = read_play_status_from_pin();
+  bool curr;
+
+  DFRobotDFPlayerMini2Core::advertise(fileNumber);
+
+  if (playlist_mode) {
+    byte transition_counter = 0;
+    while (transition_counter < 4) {
+      serviceTrigger();
+      flushSendQueue();
+      curr = read_play_status_from_pin();
+      if (prev != curr) {
+        transition_counter++;
+        prev = curr;
+      }
+    }
+  }
+  /*unsigned long timex = millis();
+  while (millis()-timex < 2000) {
+    curr = read_play_status_from_pin();
+    if (prev != curr) {
+      Serial.print("Play status transistion: ");
+      Serial.print(prev);
+      Serial.print(" -> ");
+      Serial.print(curr);
+      Serial.print(" after ");
+      Serial.print(millis()-timex);
+      Serial.println(" ms");
+      prev = curr;
+    }
+  }*/
+}
+
+// Automatic recovery from DFPlayerError codes. The error frame only marks the
+// recovery as pending, the actions run from update() without blocking.
+
+void DFRobotDFPlayerMini2::enableRecovery(){
+  _recoveryPolicy[Busy] = DFPLAYER_RECOVERY_RETRY;
+  _recoveryPolicy[Sleeping] = DFPLAYER_RECOVERY_WAKE;
+  _recoveryPolicy[SerialWrongStack] = DFPLAYER_RECOVERY_RESEND;
+  _recoveryPolicy[CheckSumNotMatch] = DFPLAYER_RECOVERY_RESEND;
+  _recoveryPolicy[FileIndexOut] = DFPLAYER_RECOVERY_SKIP;
+  _recoveryPolicy[FileMismatch] = DFPLAYER_RECOVERY_SKIP;
+}
+
+void DFRobotDFPlayerMini2::disableRecovery(){
+  for (uint8_t i=0; i<Advertise; i++) {
+    _recoveryPolicy[i] = DFPLAYER_RECOVERY_NONE;
+  }
+  _recoveryState = DFPLAYER_RECOVERY_IDLE;
+}
+
+void DFRobotDFPlayerMini2::setRecoveryPolicy(uint8_t error, uint8_t action){
+  if (error > 0 && error < Advertise) {
+    _recoveryPolicy[error] = action;
+  }
+}
+
+bool DFRobotDFPlayerMini2::recoveryEnabled(){
+  for (uint8_t i=1; i<Advertise; i++) {
+    if (_recoveryPolicy[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DFRobotDFPlayerMini2::isRecovering(){
+  return _recoveryState != DFPLAYER_RECOVERY_IDLE;
+}
+
+unsigned int DFRobotDFPlayerMini2::readRecoveryErrors(uint8_t error){
+  return (error < Advertise) ? _recoveryErrors[error] : 0;
+}
+
+unsigned int DFRobotDFPlayerMini2::readRecoverySucceeded(){
+  return _recoverySucceeded;
+}
+
+unsigned int DFRobotDFPlayerMini2::readRecoveryFailed(){
+  return _recoveryFailed;
+}
+
+unsigned long DFRobotDFPlayerMini2::readRecoveryMeanTime(){
+  return _recoverySucceeded ? _recoveryTimeTotal / _recoverySucceeded : 0;
+}
+
+bool DFRobotDFPlayerMini2::isPlayCommand(uint8_t command){
+  switch (command) {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x08:
+    case 0x0D:
+    case 0x0F:
+    case 0x12:
+    case 0x14:
+    case 0x17:
+    case 0x18:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void DFRobotDFPlayerMini2::recoveryStart(uint16_t error){
+  _recoveryErrors[error]++;
+  
+  if (_recoveryState == DFPLAYER_RECOVERY_IDLE) {
+    _recoveryStart = millis();
+    _recoveryAttempt = 0;
+    _recoveryCommand = _lastCommand;
+    _recoveryParameter = _lastParameter;
+  }
+  else if (_recoveryState == DFPLAYER_RECOVERY_SCANNING) {
+    return;
+  }
+  
+  if (_recoveryAttempt >= DFPLAYER_RECOVERY_ATTEMPTS) {
+    recoveryFinish(false);
+    return;
+  }
+  
+  _recoveryAction = _recoveryPolicy[error];
+  _recoveryTimer = millis();
+  _recoveryDelay = 0;
+  if (_recoveryAction == DFPLAYER_RECOVERY_RETRY) {
+    _recoveryDelay = (unsigned long)DFPLAYER_RECOVERY_BACKOFF << _recoveryAttempt;
+  }
+  _recoveryState = DFPLAYER_RECOVERY_PENDING;
+#ifdef _DEBUG
+  Serial.print(F("Recovering from error "));
+  Serial.print(error);
+  Serial.print(F(", attempt "));
+  Serial.println(_recoveryAttempt + 1);
+#endif
+}
+
+void DFRobotDFPlayerMini2::recoveryUpdate(){
+  switch (_recoveryState) {
+    case DFPLAYER_RECOVERY_PENDING:
+      if (millis() - _recoveryTimer < _recoveryDelay) {
+        return;
+      }
+      _recoveryAttempt++;
+      switch (_recoveryAction) {
+        case DFPLAYER_RECOVERY_WAKE:
+          sendStack(0x09, device);
+          _moduleSleeping = false;
+          _recoveryAction = DFPLAYER_RECOVERY_RESEND;
+          _recoveryTimer = millis();
+          _recoveryDelay = DFPLAYER_WAKE_TIME;
+          return;
+        case DFPLAYER_RECOVERY_SKIP:
+          _recoveryState = DFPLAYER_RECOVERY_SCANNING;
+          pl_mode_scan();
+          return;
+        default:
+          if (_recoveryCommand) {
+            sendStack(_recoveryCommand, _recoveryParameter);
+          }
+          break;
+      }
+      _recoveryState = DFPLAYER_RECOVERY_CONFIRM;
+      _recoveryTimer = millis();
+      break;
+    case DFPLAYER_RECOVERY_CONFIRM:
+      if (isPlayCommand(_recoveryCommand) && read_play_status_from_pin()) {
+        recoveryFinish(true);
+      }
+      else if (millis() - _recoveryTimer > DFPLAYER_RECOVERY_CONFIRM_TIME) {
+        //a command that should start playback did not, try again
+        if (isPlayCommand(_recoveryCommand) && _recoveryAttempt < DFPLAYER_RECOVERY_ATTEMPTS) {
+          _recoveryState = DFPLAYER_RECOVERY_PENDING;
+          _recoveryTimer = millis();
+          _recoveryDelay = 0;
+        }
+        else{
+          recoveryFinish(!isPlayCommand(_recoveryCommand));
+        }
+      }
+      break;
+    case DFPLAYER_RECOVERY_SCANNING:
+      if (pl_mode_is_scanning()) {
+        return;
+      }
+      if (playlist_mode) {
+        pl_mode_next(false);
+      }
+      if (playlist_mode) {
+        _recoveryState = DFPLAYER_RECOVERY_CONFIRM;
+        _recoveryCommand = _lastCommand;
+        _recoveryParameter = _lastParameter;
+        _recoveryTimer = millis();
+      }
+      else{
+        recoveryFinish(true);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void DFRobotDFPlayerMini2::recoveryFinish(bool success){
+  _recoveryState = DFPLAYER_RECOVERY_IDLE;
+  if (success) {
+    _recoverySucceeded++;
+    _recoveryTimeTotal += millis() - _recoveryStart;
+  }
+  else{
+    _recoveryFailed++;
+  }
+#ifdef _DEBUG
+  Serial.print(success ? F("Recovered after ") : F("Recovery failed after "));
+  Serial.print(millis() - _recoveryStart);
+  Serial.println(F(" ms"));
+#endif
+}
+
 
 // The following methods were added to the original
 // library for playlist mode.
 
 void DFRobotDFPlayerMini2::pl_mode_play_track(int announce_type) {
+  pl_mode_restore_volume();
   if (announce_type == 1) {
     pl_mode_make_announcement(101, false);
   } else if (announce_type == 2) {
@@ -600,12 +1860,12 @@ void DFRobotDFPlayerMini2::pl_mode_play_track(int announce_type) {
 }
 
 void DFRobotDFPlayerMini2::pl_mode_stop(bool hard_stop, bool announce) {
+  pl_mode_restore_volume();
   playlist_mode = false;
   pl_mode_pausing = false;
   pl_mode_curr_track = 1;
   if (hard_stop) {
-    stop();
-    wait_for_status_update(0, 300);
+    pl_mode_halt();
 #ifdef _DEBUG
     Serial.println("Playing stopped.");
 #endif
@@ -616,22 +1876,139 @@ void DFRobotDFPlayerMini2::pl_mode_stop(bool hard_stop, bool announce) {
 }
 
 void DFRobotDFPlayerMini2::get_file_counts() {
-  for (int i=0; i<MAX_PLAYLIST; i++) {
-    file_counts[i] = readFileCountsInFolder(i+1);
-    if (file_counts[i] == -1) {
-      pl_count = i;
-      break;
-    }
-    
+  pl_mode_scan();
+  while (pl_mode_is_scanning()) {
+    idle(millis(), _timeOutDuration);
+    update();
+  }
+}
+
+// Scans the file counts of all folders without blocking, driven by update().
+// The folder count (0x4F) is read first, so the scan does not have to end
+// with a timeout; the folders are then queried back-to-back, each query
+// being sent as soon as the previous one is answered.
+void DFRobotDFPlayerMini2::pl_mode_scan(void (*progress)(byte folder, byte folders)) {
+  _scanCallback = progress;
+  _scanStart = millis();
+  _scanRetries = 0;
+  _scanFolder = 0;
+  _scanFolders = 0;
+  pl_count = 0;
+  _scanState = DFPLAYER_SCAN_FOLDERS;
+  scanRequest();
+}
+
+bool DFRobotDFPlayerMini2::pl_mode_is_scanning() {
+  return _scanState != DFPLAYER_SCAN_IDLE;
+}
+
+unsigned long DFRobotDFPlayerMini2::pl_mode_read_scan_time() {
+  return _scanTime;
+}
+
+void DFRobotDFPlayerMini2::scanRequest() {
+  _scanTimer = millis();
+  if (_scanState == DFPLAYER_SCAN_FOLDERS) {
+    sendStack(0x4F);
+  } else {
+    sendStack(0x4E, _scanFolder);
+  }
+}
+
+void DFRobotDFPlayerMini2::scanRetry() {
+  if (_scanRetries < DFPLAYER_SCAN_RETRIES) {
+    _scanRetries++;
+    scanRequest();
+    return;
+  }
+  
+  _scanRetries = 0;
+  if (_scanState == DFPLAYER_SCAN_FOLDERS) {
+    //folder count not supported: probe the folders until the first one fails
+    _scanState = DFPLAYER_SCAN_FILES;
+    _scanFolder = 1;
+    scanRequest();
+    return;
+  }
+  
+  file_counts[_scanFolder-1] = 0;
+  if (_scanFolders) {
+    pl_count = _scanFolder;  //the folder exists, it counts as an empty playlist (also when it is the last one)
+  }
+  if (!_scanFolders || _scanFolder >= _scanFolders) {
+    scanFinish();
+    return;
+  }
+  _scanFolder++;
+  scanRequest();
+}
+
+void DFRobotDFPlayerMini2::scanUpdate() {
+  uint8_t expected = (_scanState == DFPLAYER_SCAN_FOLDERS) ? 0x4F : 0x4E;
+  
+  if (available()) {
+    if (_handleType == DFPlayerFeedBack && _handleCommand == expected) {
+      readType();
+      _isSending = false;
+      _scanRetries = 0;
+      
+      if (_scanState == DFPLAYER_SCAN_FOLDERS) {
+        _scanFolders = (_handleParameter < MAX_PLAYLIST) ? _handleParameter : MAX_PLAYLIST;
+        if (!_scanFolders) {
+          scanFinish();
+          return;
+        }
+        _scanState = DFPLAYER_SCAN_FILES;
+        _scanFolder = 1;
+        scanRequest();
+        return;
+      }
+      
+      file_counts[_scanFolder-1] = _handleParameter;
+      pl_count = _scanFolder;
 #ifdef _DEBUG
-    Serial.print("Files in playlist ");
-    Serial.print(i+1);
-    Serial.print(": ");
-    Serial.println(file_counts[i]);
+      Serial.print("Files in playlist ");
+      Serial.print(_scanFolder);
+      Serial.print(": ");
+      Serial.println(file_counts[_scanFolder-1]);
 #endif
+      if (_scanCallback) {
+        _scanCallback(_scanFolder, _scanFolders);
+      }
+      if (_scanFolder == _scanFolders || _scanFolder == MAX_PLAYLIST) {
+        scanFinish();
+        return;
+      }
+      _scanFolder++;
+      scanRequest();
+      return;
+    }
+    if (_handleType == DFPlayerError || _handleType == TimeOut) {
+      readType();
+      _isSending = false;
+      scanRetry();
+      return;
+    }
+  }
+  
+  if (millis() - _scanTimer > _timeOutDuration) {
+    _isSending = false;
+    scanRetry();
   }
 }
 
+void DFRobotDFPlayerMini2::scanFinish() {
+  _scanState = DFPLAYER_SCAN_IDLE;
+  _scanTime = millis() - _scanStart;
+#ifdef _DEBUG
+  Serial.print("Scan of ");
+  Serial.print(pl_count);
+  Serial.print(" playlists took ");
+  Serial.print(_scanTime);
+  Serial.println(" ms");
+#endif
+}
+
 void DFRobotDFPlayerMini2::pl_mode_change_folder(byte playlist, bool announce) {
   pl_mode_stop(false, false);
   if (pl_mode_curr_folder != playlist) {
@@ -682,12 +2059,8 @@ void DFRobotDFPlayerMini2::pl_mode_next(bool announce) {
 }
 
 void DFRobotDFPlayerMini2::pl_mode_previous(bool announce) {
-  bool first_track;
   if (pl_mode_curr_track>1) {
-    first_track = false;
     pl_mode_curr_track--;
-  } else {
-    first_track = true;
   }
 
   if(read_play_status_from_pin() == 1) {
@@ -715,16 +2088,43 @@ void DFRobotDFPlayerMini2::pl_mode_pause_resume(bool announce) {
     }
     playlist_mode = false;
     pl_mode_pausing = true;
+#ifdef DFPLAYER_FADE
+    if (pl_mode_fade_time) {
+      //fade out from update(), the pause is sent when the fade is done
+      fadeVolume(0, pl_mode_fade_time, DFPLAYER_FADE_EASE_OUT);
+      pl_mode_fade_volume = _fadeFrom;
+      pl_mode_faded = true;
+      _fadeEndCommand = 0x0E;
+    } else {
+      pause();
+      wait_for_status_update(0, 300);
+    }
+#else
     pause();
     wait_for_status_update(0, 300);
+#endif
 #ifdef _DEBUG
     Serial.println("Playback paused.");
+#endif
+#ifdef DFPLAYER_FADE
+  } else if (pl_mode_pausing && isFading()) {
+    //resumed while still fading out: fade back in
+    playlist_mode = true;
+    pl_mode_pausing = false;
+    pl_mode_faded = false;
+    fadeVolume(pl_mode_fade_volume, pl_mode_fade_time, DFPLAYER_FADE_EASE_IN);
 #endif
   } else if (!playlist_mode && !read_play_status_from_pin() && pl_mode_pausing) {
     playlist_mode = true;
     pl_mode_pausing = false;
     start();
     wait_for_status_update(1, 300);
+#ifdef DFPLAYER_FADE
+    if (pl_mode_faded) {
+      pl_mode_faded = false;
+      fadeVolume(pl_mode_fade_volume, pl_mode_fade_time, DFPLAYER_FADE_EASE_IN);
+    }
+#endif
     if (announce) {
       advertise(104);
     }
@@ -738,12 +2138,55 @@ bool DFRobotDFPlayerMini2::pl_mode_is_pausing() {
   return pl_mode_pausing;
 }
 
+#ifdef DFPLAYER_FADE
+void DFRobotDFPlayerMini2::pl_mode_set_fade(unsigned long duration) {
+  pl_mode_fade_time = duration;
+}
+
+uint8_t DFRobotDFPlayerMini2::pl_mode_fade_out() {
+  //blocking fade to silence, returns the volume to restore afterwards
+  fadeVolume(0, pl_mode_fade_time, DFPLAYER_FADE_EASE_OUT);
+  uint8_t restore = _fadeFrom;
+  while (isFading()) {
+    idle(millis(), DFPLAYER_FADE_INTERVAL / 1000);
+  }
+  return restore;
+}
+#endif
+
+void DFRobotDFPlayerMini2::pl_mode_restore_volume() {
+  //a faded pause leaves the volume at 0; anything but resume that ends the pause
+  //(stop, another track, an announcement) sets it back
+#ifdef DFPLAYER_FADE
+  if (pl_mode_faded) {
+    pl_mode_faded = false;
+    stopFade();
+    volume(pl_mode_fade_volume);
+  }
+#endif
+}
+
+void DFRobotDFPlayerMini2::pl_mode_halt() {
+  //stops the playback, faded out with pl_mode_set_fade()
+#ifdef DFPLAYER_FADE
+  if (pl_mode_fade_time && read_play_status_from_pin()) {
+    uint8_t restore = pl_mode_fade_out();
+    stop();
+    wait_for_status_update(0, 300);
+    volume(restore);
+    return;
+  }
+#endif
+  stop();
+  wait_for_status_update(0, 300);
+}
+
 void DFRobotDFPlayerMini2::pl_mode_make_announcement(byte ann_nr, bool pl) {
+  pl_mode_restore_volume();
   pl_mode_announcing = true;
   
   if (read_play_status_from_pin() == 1) {
-    stop();
-    wait_for_status_update(0, 300);
+    pl_mode_halt();
   }
   
   if (pl) {
@@ -754,8 +2197,31 @@ void DFRobotDFPlayerMini2::pl_mode_make_announcement(byte ann_nr, bool pl) {
   wait_for_status_update(1, 300);
 }
 
-bool DFRobotDFPlayerMini2::read_play_status_from_pin() {
-  play_status = !digitalRead(PLAYING_PIN);
+bool DFRobotDFPlayerMini2Core::read_play_status_from_pin() {
+#ifdef DFPLAYER_TRACE
+  bool prev = play_status;
+#endif
+  play_status = !digitalRead(_busyPin);
+#ifdef DFPLAYER_TRIGGER
+  if (_triggerBusyPending) {
+    unsigned long latency = micros() - _triggerTime;
+    if (play_status) {
+      _triggerBusyPending = false;
+      _triggerLatency = latency;
+      if (latency > _triggerLatencyMax) {
+        _triggerLatencyMax = latency;
+      }
+    }
+    else if (latency > DFPLAYER_TRIGGER_BUSY_TIME) {
+      _triggerBusyPending = false;
+    }
+  }
+#endif
+#ifdef DFPLAYER_TRACE
+  if (prev != play_status) {
+    trace(DFPLAYER_TRACE_BUSY, play_status, 0);
+  }
+#endif
   return play_status;
 }
 
@@ -774,7 +2240,7 @@ bool DFRobotDFPlayerMini2::pl_mode_check_playback() {
     return true;
   }
   
-  if (playlist_mode && !read_play_status_from_pin() && !pl_mode_pausing && !pl_mode_announcing && !pl_mode_halted) {
+  if (playlist_mode && !read_play_status_from_pin() && !pl_mode_pausing && !pl_mode_announcing && !pl_mode_halted && !isRecovering()) {
     pl_mode_next(false);
     return true;
   }
@@ -794,11 +2260,12 @@ byte DFRobotDFPlayerMini2::pl_mode_read_curr_folder() {
   return pl_mode_curr_folder;
 }
 
-unsigned int DFRobotDFPlayerMini2::wait_for_status_update(bool next_status, unsigned int max_time) {
+unsigned int DFRobotDFPlayerMini2Core::wait_for_status_update(bool next_status, unsigned int max_time) {
   unsigned long timer_start = millis();
   unsigned int status_update_delay = 0;
   while (read_play_status_from_pin() != next_status && status_update_delay < max_time) {
     //wait for play status update or timeout
+    idle(timer_start, max_time);
     status_update_delay = millis() - timer_start;
   }
 #ifdef _DEBUG
@@ -32,9 +32,57 @@
 
 #define DFPLAYER_RECEIVED_LENGTH 10
 #define DFPLAYER_SEND_LENGTH 10
+//queue for frames without ACK: sendStack() returns at once and the frames are released
+//by available(), update() and the waits of the library. Without it a frame that comes
+//too early waits out the rest of DFPLAYER_SEND_INTERVAL in idle().
+//#define DFPLAYER_SEND_QUEUE
+#ifndef DFPLAYER_SEND_QUEUE_LENGTH
+  #define DFPLAYER_SEND_QUEUE_LENGTH 8
+#endif
+#define DFPLAYER_SEND_INTERVAL 10000  //minimum gap between two frames without ack in us
+#define DFPLAYER_FRAME_TIME 10417      //us per frame at 9600 baud (10 bytes of 10 bits)
+#ifndef DFPLAYER_FRAME_QUEUE_LENGTH
+  #define DFPLAYER_FRAME_QUEUE_LENGTH 8  //received frames buffered by receive(), one slot stays free
+#endif
+
+#define DFPLAYER_RECEIVE_POLL 0   //bytes are parsed by available()
+#define DFPLAYER_RECEIVE_EVENT 1  //bytes are parsed by receive() from serialEvent() or an interrupt
 
 //#define _DEBUG
 
+//liveness monitor that resets the module and restores its state, see enableHealthMonitor()
+//#define DFPLAYER_HEALTH_MONITOR
+
+//non-blocking volume fades, see fadeVolume() and pl_mode_set_fade()
+//#define DFPLAYER_FADE
+
+//queue of received frames for the event receive mode, see setReceiveMode()
+//#define DFPLAYER_FRAME_QUEUE
+#if (defined(DFPLAYER_HEALTH_MONITOR) || defined(DFPLAYER_FADE)) && !defined(DFPLAYER_FRAME_QUEUE)
+  #define DFPLAYER_FRAME_QUEUE  //both parse the input outside available() through the queue
+#endif
+
+//bounded-latency sound effects, see trigger()
+//#define DFPLAYER_TRIGGER
+
+//non-blocking begin with warm-start detection, see beginAsync()
+//#define DFPLAYER_BEGIN_ASYNC
+
+//module sleep after an idle time, see setAutoSleep()
+//#define DFPLAYER_AUTO_SLEEP
+
+//binary trace of TX/RX frames and BUSY edges, see dumpTrace()
+//#define DFPLAYER_TRACE
+#ifndef DFPLAYER_TRACE_LENGTH
+  #define DFPLAYER_TRACE_LENGTH 64
+#endif
+
+#define DFPLAYER_TRACE_TX 0
+#define DFPLAYER_TRACE_RX 1
+#define DFPLAYER_TRACE_RX_ERROR 2  //command: number of rejected bytes, parameter: bytes 1 and 2
+#define DFPLAYER_TRACE_BUSY 3
+#define DFPLAYER_TRACE_RX_DATA 4   //follows DFPLAYER_TRACE_RX_ERROR: the next three rejected bytes
+
 #define TimeOut 0
 #define WrongStack 1
 #define DFPlayerCardInserted 2
@@ -65,12 +113,92 @@
 #define Stack_CheckSum 7
 #define Stack_End 9
 
+#define DFPLAYER_PARSE_PENDING 0
+#define DFPLAYER_PARSE_COMPLETE 1
+#define DFPLAYER_PARSE_ERROR 2
+
+#define DFPLAYER_BEGIN_DONE 0
+#define DFPLAYER_BEGIN_PROBE 1
+#define DFPLAYER_BEGIN_RESET 2
+#define DFPLAYER_BEGIN_SETTLE 3
+
+#define DFPLAYER_BEGIN_PROBE_TIME 200   //time a running module gets to answer the status query
+#define DFPLAYER_BEGIN_RESET_TIME 2000  //time to wait for the 0x3F online frame after reset
+#define DFPLAYER_BEGIN_SETTLE_TIME 200
+
+#define DFPLAYER_WAKE_TIME 200  //time the module needs after 0x09 to leave sleep
+#define DFPLAYER_DEVICE_SWITCH_TIME 200  //time the module needs after 0x09 to switch the device
+
+#define DFPLAYER_HEALTH_IDLE 0
+#define DFPLAYER_HEALTH_PROBE 1
+#define DFPLAYER_HEALTH_RESET 2
+#define DFPLAYER_HEALTH_SETTLE 3
+#define DFPLAYER_HEALTH_RESTORE 4
+
+#define DFPLAYER_HEALTH_INTERVAL 1000  //default ms without any frame from the module before it is probed
+#define DFPLAYER_HEALTH_FAILURES 3     //default consecutive failed probes/timeouts before a reset
+
+#define DFPLAYER_TRIGGER_BUSY_TIME 1000000  //us to wait for BUSY after a trigger before giving up the measurement
+
+#define DFPLAYER_FADE_LINEAR 0
+#define DFPLAYER_FADE_EASE_IN 1   //slow start, for fading in
+#define DFPLAYER_FADE_EASE_OUT 2  //slow end, for fading out
+
+#define DFPLAYER_FADE_INTERVAL (2 * DFPLAYER_FRAME_TIME)  //fade steps use at most half of the line
+
+#define DFPLAYER_SNAPSHOT_STATE 0x01
+#define DFPLAYER_SNAPSHOT_VOLUME 0x02
+#define DFPLAYER_SNAPSHOT_EQ 0x04
+#define DFPLAYER_SNAPSHOT_FILE_COUNTS 0x08
+#define DFPLAYER_SNAPSHOT_CURRENT_FILE 0x10
+#define DFPLAYER_SNAPSHOT_FOLDER_COUNTS 0x20
+#define DFPLAYER_SNAPSHOT_ALL 0x3F
+
+//result of readSnapshot(), fields that were not answered are -1
+struct DFPlayerSnapshot {
+  uint8_t valid;  //DFPLAYER_SNAPSHOT_* bits of the answered fields
+  int state;
+  int volume;
+  int eq;
+  int fileCounts;
+  int currentFileNumber;
+  int folderCounts;
+};
+
 //Added for playlist playback
-#define MAX_PLAYLIST 255
+#ifndef MAX_PLAYLIST
+  #define MAX_PLAYLIST 255
+#endif
 #define PLAYING_PIN 4
+
+#define DFPLAYER_SCAN_IDLE 0
+#define DFPLAYER_SCAN_FOLDERS 1
+#define DFPLAYER_SCAN_FILES 2
+#define DFPLAYER_SCAN_RETRIES 2  //retries of a single failed query during a scan
+
+#define DFPLAYER_RECOVERY_NONE 0
+#define DFPLAYER_RECOVERY_RETRY 1   //back off, then send the failed command again
+#define DFPLAYER_RECOVERY_WAKE 2    //wake the module, then send the failed command again
+#define DFPLAYER_RECOVERY_RESEND 3  //send the failed command again immediately
+#define DFPLAYER_RECOVERY_SKIP 4    //rescan the folders and skip to the next track
+
+#define DFPLAYER_RECOVERY_IDLE 0
+#define DFPLAYER_RECOVERY_PENDING 1
+#define DFPLAYER_RECOVERY_CONFIRM 2
+#define DFPLAYER_RECOVERY_SCANNING 3
+
+#define DFPLAYER_RECOVERY_ATTEMPTS 3
+#define DFPLAYER_RECOVERY_BACKOFF 100        //ms before the first retry on Busy, doubled per attempt
+#define DFPLAYER_RECOVERY_CONFIRM_TIME 500   //ms without a new error (or until BUSY) to count as recovered
 /////////////////////////////
 
-class DFRobotDFPlayerMini2 {
+//Protocol core: frames, queries and basic playback commands.
+class DFRobotDFPlayerMini2Core {
+  friend class DFRobotDFPlayerMini2Concurrent;
+  friend class DFRobotDFPlayerMini2Catalog;
+  
+  protected:
+  
   Stream* _serial;
   
   unsigned long _timeOutTimer;
@@ -80,7 +208,33 @@ class DFRobotDFPlayerMini2 {
   uint8_t _sending[DFPLAYER_SEND_LENGTH] = {0x7E, 0xFF, 06, 00, 01, 00, 00, 00, 00, 0xEF};
   
   uint8_t _receivedIndex=0;
+  
+#ifdef DFPLAYER_SEND_QUEUE
+  uint8_t _sendQueue[DFPLAYER_SEND_QUEUE_LENGTH][DFPLAYER_SEND_LENGTH];
+  uint8_t _sendQueueHead = 0;
+  uint8_t _sendQueueCount = 0;
+  unsigned long _sendTimer = 0;
+#endif
+  
+#ifdef DFPLAYER_FRAME_QUEUE
+  uint8_t _receiveMode = DFPLAYER_RECEIVE_POLL;
+  volatile uint8_t _frameQueue[DFPLAYER_FRAME_QUEUE_LENGTH][DFPLAYER_RECEIVED_LENGTH];
+  volatile uint8_t _frameQueueHead = 0;  //written by available() only
+  volatile uint8_t _frameQueueTail = 0;  //written by receive() only
+  volatile bool _receiving = false;
+  volatile uint8_t _receiveErrors = 0;
+  uint8_t _receiveErrorsHandled = 0;
+  volatile unsigned long _droppedFrames = 0;
+  void receiveFrames();
+#endif
 
+  void pollFrames();
+  uint16_t takeError();
+  
+  void writeStack(uint8_t *buffer);
+  void flushSendQueue();
+  bool sendPending();
+  void waitFrameGap();
   void sendStack();
   void sendStack(uint8_t command);
   void sendStack(uint8_t command, uint16_t argument);
@@ -95,22 +249,126 @@ class DFRobotDFPlayerMini2 {
   
   uint16_t calculateCheckSum(uint8_t *buffer);
   
-  void parseStack();
+  void parseStack(uint8_t *frame);
   bool validateStack();
+  bool checkByte(uint8_t index, uint8_t value);
+  void resync();
+  uint8_t parseByte(uint8_t value);
   
   uint8_t device = DFPLAYER_DEVICE_SD;
   
-  //Added for playlist playback
-  byte pl_mode_curr_track;
-  byte pl_mode_curr_folder;
-  bool playlist_mode;
-  bool pl_mode_pausing;
-  bool pl_mode_announcing;
-  int file_counts[MAX_PLAYLIST];
-  byte pl_count;
-  bool play_status;
-  bool pl_mode_halted;
-  /////////////////////////////
+  unsigned long _beginStart;
+  unsigned long _bootTime = 0;
+#ifdef DFPLAYER_BEGIN_ASYNC
+  uint8_t _beginState = DFPLAYER_BEGIN_DONE;
+  bool _beginOnline = false;
+  unsigned long _beginTimer;
+  void (*_readyCallback)(bool online) = NULL;
+  
+  void beginUpdate();
+  void beginFinish();
+#endif
+  
+#ifdef DFPLAYER_TRACE
+  struct TraceEntry {
+    uint32_t time;
+    uint8_t type;
+    uint8_t command;
+    uint16_t parameter;
+  };
+  TraceEntry _trace[DFPLAYER_TRACE_LENGTH];
+  uint16_t _traceHead = 0;
+  uint16_t _traceCount = 0;
+  
+  void trace(uint8_t type, uint8_t command, uint16_t parameter);
+  void traceRejected(uint8_t *bytes, uint8_t length);
+#endif
+  
+  void (*_idleHook)(unsigned long duration) = NULL;
+  uint8_t _busyPin = PLAYING_PIN;
+#ifdef DFPLAYER_AUTO_SLEEP
+  unsigned long _autoSleepTime = 0;
+  unsigned long _lastActivity = 0;
+#endif
+  bool _moduleSleeping = false;
+  bool _deviceSwitching = false;
+  unsigned long _deviceSwitchTimer;
+  unsigned long _wakeLatency = 0;
+  unsigned long _statsStart = 0;
+  unsigned long _idleTime = 0;
+  
+  void idle(unsigned long timer, unsigned long duration);
+  void wakeModule();
+  
+  bool play_status = false;
+  
+  uint8_t _lastCommand = 0;
+  uint16_t _lastParameter = 0;
+  bool _lastTracked = false;  //the last frame written was _lastCommand
+  volatile uint16_t _errorPending = 0;  //set by checkFrame(), may run from an interrupt
+  
+  unsigned long _lastWrite = 0;
+#ifdef DFPLAYER_TRIGGER
+  volatile int _triggerRequest = 0;
+  volatile bool _triggerOverMusic = false;
+  volatile unsigned long _triggerRequestTime;
+  bool _triggerBusyPending = false;
+  unsigned long _triggerTime;
+  unsigned long _triggerLatency = 0;
+  unsigned long _triggerLatencyMax = 0;
+  unsigned long _triggerSendLatencyMax = 0;
+#endif
+  
+  void serviceTrigger();
+  void writeFrame(uint8_t command, uint16_t parameter);
+  
+  //state restored by the health monitor after a reset, the volume is also the start of a fade
+  uint8_t _shadowVolume = 0xFF;  //unknown
+#ifdef DFPLAYER_HEALTH_MONITOR
+  uint8_t _shadowEQ = DFPLAYER_EQ_NORMAL;
+  uint8_t _shadowPlayCommand = 0;
+  uint16_t _shadowPlayParameter;
+  bool _shadowPaused = false;
+#endif
+  void shadowCommand(uint8_t command, uint16_t argument);
+  
+  bool checkFrame(uint8_t *frame);
+#ifdef DFPLAYER_HEALTH_MONITOR
+  unsigned long _healthInterval = 0;  //0: monitor disabled
+  uint8_t _healthThreshold;
+  uint8_t _healthState = DFPLAYER_HEALTH_IDLE;
+  //written by checkFrame(), which may run in receive() from an interrupt
+  volatile uint8_t _healthFailures = 0;
+  volatile bool _healthProbePending = false;
+  volatile bool _healthOnline;
+  volatile unsigned long _healthLastAlive;
+  unsigned long _healthTimer;
+  unsigned long _healthDetect;
+  unsigned long _healthProbeTime;
+  unsigned long _healthLatency = 0;
+  unsigned long _healthLatencyMin = 0;
+  unsigned int _healthResets = 0;
+  unsigned long _healthDetectionTime = 0;
+  unsigned long _healthRestartTime = 0;
+  void healthUpdate();
+#endif
+  
+#ifdef DFPLAYER_FADE
+  bool _fading = false;
+  uint8_t _fadeFrom;
+  uint8_t _fadeTo;
+  uint8_t _fadeLevel;
+  uint8_t _fadeCurve;
+  uint8_t _fadeEndCommand = 0;  //sent when the fade is done, e.g. 0x0E to pause after a fade out
+  unsigned long _fadeStart;
+  unsigned long _fadeDuration;
+  unsigned long _fadeLastStep;
+  unsigned int _fadeSteps = 0;
+  uint8_t _fadeMaxJump = 0;
+  unsigned long _fadeMaxInterval = 0;
+  void fadeUpdate();
+  void finishFade();
+#endif
   
   public:
   
@@ -118,19 +376,136 @@ class DFRobotDFPlayerMini2 {
   uint8_t _handleCommand;
   uint16_t _handleParameter;
   bool _isAvailable = false;
-  bool _isSending = false;
+  volatile bool _isSending = false;
   
   bool handleMessage(uint8_t type, uint16_t parameter = 0);
   bool handleError(uint8_t type, uint16_t parameter = 0);
 
   uint8_t readCommand();
   
-  bool begin(Stream& stream, bool isACK = true, bool doReset = true);
+  //virtual, so that helpers holding a DFRobotDFPlayerMini2Core* (catalog, ping-pong)
+  //also run the playlist engine and recovery of a DFRobotDFPlayerMini2
+  virtual bool begin(Stream& stream, bool isACK = true, bool doReset = true);
+  
+#ifdef DFPLAYER_BEGIN_ASYNC
+  virtual bool beginAsync(Stream& stream, bool isACK = true);
+  
+  void setReadyCallback(void (*callback)(bool online));
+#endif
+  
+  //false while beginAsync() is still running
+  bool isReady();
+  
+  unsigned long readBootTime();
+  
+  virtual void update();
+  
+  //hook called by every wait of the library instead of spinning. It may put the
+  //CPU to sleep for at most duration ms and should return early on UART RX, a
+  //BUSY pin change or an interrupt that calls requestTrigger().
+  void setIdleHook(void (*hook)(unsigned long duration));
+  
+  void setBusyPin(uint8_t pin);
+  
+#ifdef DFPLAYER_AUTO_SLEEP
+  void setAutoSleep(unsigned long idleSeconds);
+#endif
+  
+  bool isSleeping();
+  
+  uint8_t readDutyCycle();
+  
+  void resetDutyCycle();
+  
+  unsigned long readWakeLatency();
+  
+#ifdef DFPLAYER_TRIGGER
+  //high-priority sound effect: the frame is written at once, ahead of queued commands
+  //and without waiting for an ACK. With overMusic the file is played with advertise()
+  //(ADVERT folder) if music is playing, otherwise with playMp3Folder() (MP3 folder).
+  void trigger(int fileNumber, bool overMusic = false);
+  
+  //interrupt safe variant of trigger(), executed by the next wait, available() or update()
+  void requestTrigger(int fileNumber, bool overMusic = false);
+  
+  //time from the trigger to BUSY going low in us (last and worst case)
+  unsigned long readTriggerLatency();
+  
+  unsigned long readTriggerLatencyMax();
+  
+  //worst time from requestTrigger() until the frame was written in us
+  unsigned long readTriggerSendLatencyMax();
+#endif
+  
+#ifdef DFPLAYER_TRACE
+  //writes the recorded trace in binary form (see extras/linux/dfplayer_trace.cpp) and clears it
+  void dumpTrace(Print &out);
+  
+  void clearTrace();
+#endif
   
   bool waitAvailable(unsigned long duration = 0);
   
   bool available();
   
+#ifdef DFPLAYER_FRAME_QUEUE
+  //DFPLAYER_RECEIVE_POLL (default) or DFPLAYER_RECEIVE_EVENT
+  void setReceiveMode(uint8_t mode);
+  
+  //in DFPLAYER_RECEIVE_EVENT mode: parses all pending bytes and queues completed
+  //frames for available(). Call it from serialEvent(), a UART RX/timer interrupt
+  //or Serial.onReceive() on ESP32.
+  void receive();
+  
+  //frames lost because the frame queue was full
+  unsigned long readDroppedFrames();
+#endif
+  
+#ifdef DFPLAYER_HEALTH_MONITOR
+  //liveness monitor run by update(): when the module was silent for interval ms it
+  //is probed with a status query (0x42) whose answer is not reported. After
+  //failures consecutive failed probes or TimeOuts the module is reset and the last
+  //device, volume, EQ and track are restored.
+  void enableHealthMonitor(unsigned long interval = DFPLAYER_HEALTH_INTERVAL, uint8_t failures = DFPLAYER_HEALTH_FAILURES);
+  
+  void disableHealthMonitor();
+  
+  bool isRestarting();
+  
+  //smoothed probe round trip in us and its rise above the fastest probe seen
+  unsigned long readProbeLatency();
+  
+  unsigned long readProbeLatencyDrift();
+  
+  unsigned int readHealthResets();
+  
+  //last incident: ms from the last frame of the module until the reset, and from
+  //the reset until the state was restored
+  unsigned long readDetectionTime();
+  
+  unsigned long readRestartTime();
+#endif
+  
+#ifdef DFPLAYER_FADE
+  //ramps the volume to target within duration ms without blocking. The steps are
+  //sent from update() and all waits of the library, only while no user command is
+  //pending and at most every DFPLAYER_FADE_INTERVAL; a volume command ends the fade
+  //(and sends the pause of a fading pl_mode_pause_resume() at once).
+  void fadeVolume(uint8_t target, unsigned long duration, uint8_t curve = DFPLAYER_FADE_LINEAR);
+  
+  bool isFading();
+  
+  void stopFade();
+  
+  //last fade: volume frames sent, largest volume jump of one step and longest
+  //time between two steps in ms
+  unsigned int readFadeSteps();
+  
+  uint8_t readFadeMaxJump();
+  
+  unsigned long readFadeMaxInterval();
+#endif
+  
   uint8_t readType();
   
   uint16_t read();
@@ -153,8 +528,11 @@ class DFRobotDFPlayerMini2 {
   
   void loop(int fileNumber);
   
+  //returns at once; the next command waits until the switch had DFPLAYER_DEVICE_SWITCH_TIME
   void outputDevice(uint8_t device);
   
+  bool isSwitchingDevice();
+  
   void sleep();
   
   void reset();
@@ -165,24 +543,9 @@ class DFRobotDFPlayerMini2 {
   
   void playFolder(uint8_t folderNumber, uint8_t fileNumber);
     
-  //Added for playlist playback
-  void get_file_counts();
   bool read_play_status_from_pin();
-  bool pl_mode_is_active();
-  void pl_mode_change_folder(byte playlist, bool announce);
-  void pl_mode_play_track(int announce_type);
-  void pl_mode_stop(bool hard_stop, bool announce);
-  void pl_mode_next(bool announce);
-  void pl_mode_previous(bool announce);
-  void pl_mode_pause_resume(bool announce);
-  bool pl_mode_is_pausing();
-  void pl_mode_make_announcement(byte ann_nr, bool pl);
-  bool pl_mode_check_playback();
+  
   unsigned int wait_for_status_update(bool next_status, unsigned int max_time);
-  byte pl_mode_read_curr_track();
-  byte pl_mode_read_curr_folder();
-  byte pl_mode_read_pl_count();
-  /////////////////////////////
   
   void outputSetting(bool enable, uint8_t gain);
   
@@ -192,7 +555,7 @@ class DFRobotDFPlayerMini2 {
   
   void playMp3Folder(int fileNumber);
   
-  void advertise(int fileNumber);
+  virtual void advertise(int fileNumber);
   
   void playLargeFolder(uint8_t folderNumber, uint16_t fileNumber);
   
@@ -230,6 +593,116 @@ class DFRobotDFPlayerMini2 {
   
   int readCurrentFileNumber();
   
+  //sends all status queries back-to-back and collects the answers until all
+  //arrived or duration ms (default: the time out) passed. Returns true if all
+  //fields are valid.
+  bool readSnapshot(DFPlayerSnapshot &snapshot, uint8_t device = DFPLAYER_DEVICE_SD, unsigned long duration = 0);
+  
+};
+
+//Protocol core plus playlist engine, folder scan and error recovery.
+class DFRobotDFPlayerMini2 : public DFRobotDFPlayerMini2Core {
+  //Added for playlist playback
+  byte pl_mode_curr_track;
+  byte pl_mode_curr_folder;
+  bool playlist_mode;
+  bool pl_mode_pausing;
+  bool pl_mode_announcing;
+  int file_counts[MAX_PLAYLIST];
+  byte pl_count;
+  bool pl_mode_halted;
+#ifdef DFPLAYER_FADE
+  unsigned long pl_mode_fade_time = 0;
+  uint8_t pl_mode_fade_volume;
+  bool pl_mode_faded = false;  //paused with a fade out, the volume is 0
+  
+  uint8_t pl_mode_fade_out();
+#endif
+  void pl_mode_halt();
+  void pl_mode_restore_volume();
+  
+  void initPlaylistState();
+  
+  uint8_t _scanState = DFPLAYER_SCAN_IDLE;
+  uint8_t _scanFolder;
+  uint8_t _scanFolders;
+  uint8_t _scanRetries;
+  unsigned long _scanTimer;
+  unsigned long _scanStart;
+  unsigned long _scanTime = 0;
+  void (*_scanCallback)(byte folder, byte folders) = NULL;
+  
+  uint8_t _recoveryPolicy[Advertise] = {DFPLAYER_RECOVERY_NONE};
+  uint8_t _recoveryState = DFPLAYER_RECOVERY_IDLE;
+  uint8_t _recoveryAction;
+  uint8_t _recoveryAttempt;
+  uint8_t _recoveryCommand;
+  uint16_t _recoveryParameter;
+  unsigned long _recoveryStart;
+  unsigned long _recoveryTimer;
+  unsigned long _recoveryDelay;
+  unsigned int _recoveryErrors[Advertise] = {0};
+  unsigned int _recoverySucceeded = 0;
+  unsigned int _recoveryFailed = 0;
+  unsigned long _recoveryTimeTotal = 0;
+  
+  bool isPlayCommand(uint8_t command);
+  bool recoveryEnabled();
+  void recoveryStart(uint16_t error);
+  void recoveryUpdate();
+  void recoveryFinish(bool success);
+  
+  void scanRequest();
+  void scanRetry();
+  void scanUpdate();
+  void scanFinish();
+  /////////////////////////////
+  
+  public:
+  
+  virtual bool begin(Stream& stream, bool isACK = true, bool doReset = true);
+  
+#ifdef DFPLAYER_BEGIN_ASYNC
+  virtual bool beginAsync(Stream& stream, bool isACK = true);
+#endif
+  
+  virtual void update();
+  
+  virtual void advertise(int fileNumber);
+  
+  //automatic recovery from DFPlayerError codes, with a default action per error
+  void enableRecovery();
+  void disableRecovery();
+  void setRecoveryPolicy(uint8_t error, uint8_t action);
+  bool isRecovering();
+  unsigned int readRecoveryErrors(uint8_t error);
+  unsigned int readRecoverySucceeded();
+  unsigned int readRecoveryFailed();
+  unsigned long readRecoveryMeanTime();
+  
+  //Added for playlist playback
+  void get_file_counts();
+  void pl_mode_scan(void (*progress)(byte folder, byte folders) = NULL);
+  bool pl_mode_is_scanning();
+  unsigned long pl_mode_read_scan_time();
+  bool pl_mode_is_active();
+  void pl_mode_change_folder(byte playlist, bool announce);
+  void pl_mode_play_track(int announce_type);
+  void pl_mode_stop(bool hard_stop, bool announce);
+  void pl_mode_next(bool announce);
+  void pl_mode_previous(bool announce);
+  void pl_mode_pause_resume(bool announce);
+  bool pl_mode_is_pausing();
+#ifdef DFPLAYER_FADE
+  //fade time in ms for pause/resume, stop and announcements, 0 switches fading off
+  void pl_mode_set_fade(unsigned long duration);
+#endif
+  void pl_mode_make_announcement(byte ann_nr, bool pl);
+  bool pl_mode_check_playback();
+  byte pl_mode_read_curr_track();
+  byte pl_mode_read_curr_folder();
+  byte pl_mode_read_pl_count();
+  /////////////////////////////
 };
 
 #endif
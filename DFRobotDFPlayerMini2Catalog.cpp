@@ -0,0 +1,356 @@
+/*!
+ * @file DFRobotDFPlayerMini2Catalog.cpp
+ * @brief Folder and file catalog of all media of a DFPlayer (U-disk, SD, flash)
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "DFRobotDFPlayerMini2Catalog.h"
+
+static const uint8_t catalogDevices[DFPLAYER_CATALOG_DEVICES] = {DFPLAYER_DEVICE_U_DISK, DFPLAYER_DEVICE_SD, DFPLAYER_DEVICE_FLASH};
+static const uint8_t catalogFileQueries[DFPLAYER_CATALOG_DEVICES] = {0x47, 0x48, 0x49};
+
+DFRobotDFPlayerMini2Catalog::DFRobotDFPlayerMini2Catalog(DFRobotDFPlayerMini2Core &player){
+  _player = &player;
+  for (uint8_t i=0; i<DFPLAYER_CATALOG_DEVICES; i++) {
+    _files[i] = -1;
+    _folders[i] = 0;
+  }
+}
+
+int8_t DFRobotDFPlayerMini2Catalog::deviceIndex(uint8_t device){
+  for (uint8_t i=0; i<DFPLAYER_CATALOG_DEVICES; i++) {
+    if (catalogDevices[i] == device) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void DFRobotDFPlayerMini2Catalog::refresh(){
+  _stale = (1 << DFPLAYER_CATALOG_DEVICES) - 1;
+}
+
+bool DFRobotDFPlayerMini2Catalog::isIndexing(){
+  return _state >= DFPLAYER_CATALOG_TOTALS && _state <= DFPLAYER_CATALOG_FILES;
+}
+
+void DFRobotDFPlayerMini2Catalog::setEventCallback(void (*callback)(uint8_t type, uint16_t parameter)){
+  _eventCallback = callback;
+}
+
+void DFRobotDFPlayerMini2Catalog::query(uint8_t command, uint16_t parameter){
+  _player->sendStack(command, parameter);
+  _waiting = true;
+  _expected = command;
+  _timer = millis();
+}
+
+void DFRobotDFPlayerMini2Catalog::update(){
+  _player->update();
+
+  while (_player->available()) {
+    uint8_t type = _player->readType();
+    uint16_t parameter = _player->read();
+    if (_waiting && type == DFPlayerFeedBack && _player->_handleCommand == _expected) {
+      answer(parameter, true);
+      continue;
+    }
+    if (_waiting && type == DFPlayerError) {
+      answer(0, false);  //the error frame answers the query, e.g. no such device
+    }
+    handleEvent(type);
+    if (_eventCallback) {
+      _eventCallback(type, parameter);
+    }
+  }
+
+  if (_waiting && millis() - _timer > _player->_timeOutDuration) {
+    answer(0, false);
+  }
+
+  switch (_state) {
+    case DFPLAYER_CATALOG_IDLE:
+      if (_player->read_play_status_from_pin()) {
+        break;
+      }
+      if (_queueCount) {
+        schedule();
+      }
+      else if (_stale) {
+        //the file count queries work without switching the device
+        _homeDevice = _player->device;
+        _indexMask = 0;
+        _indexDevice = 0;
+        _state = DFPLAYER_CATALOG_TOTALS;
+        nextTotal();
+      }
+      break;
+    case DFPLAYER_CATALOG_SWITCH:
+      if (!_player->isSwitchingDevice()) {
+        indexFolders();
+      }
+      break;
+    case DFPLAYER_CATALOG_PLAY_SWITCH:
+      if (_player->isSwitchingDevice()) {
+        break;
+      }
+      //the queue may have changed during the switch, pick the entry again
+      if (_queueCount) {
+        schedule();
+      }
+      else{
+        _state = DFPLAYER_CATALOG_IDLE;
+      }
+      break;
+    case DFPLAYER_CATALOG_PLAYING:
+      if (_player->read_play_status_from_pin()) {
+        _started = true;
+      }
+      else if (_started || _finished || millis() - _timer > DFPLAYER_CATALOG_START_TIME) {
+        _state = DFPLAYER_CATALOG_IDLE;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void DFRobotDFPlayerMini2Catalog::handleEvent(uint8_t type){
+  int8_t index = -1;
+  switch (type) {
+    case DFPlayerUSBInserted:
+    case DFPlayerCardInserted:
+      index = deviceIndex((type == DFPlayerUSBInserted) ? DFPLAYER_DEVICE_U_DISK : DFPLAYER_DEVICE_SD);
+      _stale |= 1 << index;
+      break;
+    case DFPlayerUSBRemoved:
+    case DFPlayerCardRemoved:
+      index = deviceIndex((type == DFPlayerUSBRemoved) ? DFPLAYER_DEVICE_U_DISK : DFPLAYER_DEVICE_SD);
+      _files[index] = -1;
+      _folders[index] = 0;
+      _indexed |= 1 << index;
+      _stale &= ~(1 << index);
+      for (uint8_t i=_queueCount; i>0; i--) {
+        if (_queue[i-1].device == catalogDevices[index]) {
+          removeEntry(i-1);
+        }
+      }
+      break;
+    case DFPlayerPlayFinished:
+      _finished = true;
+      break;
+    default:
+      break;
+  }
+}
+
+void DFRobotDFPlayerMini2Catalog::answer(uint16_t value, bool valid){
+  _waiting = false;
+  uint8_t index = _indexDevice;
+
+  switch (_state) {
+    case DFPLAYER_CATALOG_TOTALS:
+      _files[index] = (valid && value) ? value : -1;
+      if (_files[index] > 0) {
+        _indexMask |= 1 << index;
+      }
+      else{
+        _folders[index] = 0;
+        _indexed |= 1 << index;
+      }
+      _indexDevice++;
+      nextTotal();
+      break;
+    case DFPLAYER_CATALOG_FOLDERS:
+      _folders[index] = valid ? ((value < DFPLAYER_CATALOG_MAX_FOLDERS) ? value : DFPLAYER_CATALOG_MAX_FOLDERS) : 0;
+      if (!_folders[index]) {
+        _indexed |= 1 << index;
+        nextDevice();
+        break;
+      }
+      _indexFolder = 1;
+      _state = DFPLAYER_CATALOG_FILES;
+      query(0x4E, _indexFolder);
+      break;
+    case DFPLAYER_CATALOG_FILES:
+      _folderFiles[index][_indexFolder-1] = valid ? ((value < 255) ? value : 255) : 0;
+      if (_indexFolder < _folders[index]) {
+        _indexFolder++;
+        query(0x4E, _indexFolder);
+        break;
+      }
+      _indexed |= 1 << index;
+      nextDevice();
+      break;
+    default:
+      break;
+  }
+}
+
+void DFRobotDFPlayerMini2Catalog::nextTotal(){
+  while (_indexDevice < DFPLAYER_CATALOG_DEVICES && !(_stale & (1 << _indexDevice))) {
+    _indexDevice++;
+  }
+  if (_indexDevice < DFPLAYER_CATALOG_DEVICES) {
+    _stale &= ~(1 << _indexDevice);
+    _indexed &= ~(1 << _indexDevice);
+    query(catalogFileQueries[_indexDevice]);
+    return;
+  }
+  nextDevice();
+}
+
+void DFRobotDFPlayerMini2Catalog::nextDevice(){
+  if (!_indexMask) {
+    //done: go back to the device the sketch was using, the next command waits for the switch
+    if (_player->device != _homeDevice) {
+      _player->outputDevice(_homeDevice);
+    }
+    _state = DFPLAYER_CATALOG_IDLE;
+    return;
+  }
+
+  //the current device first, so that each device is switched to at most once
+  int8_t current = deviceIndex(_player->device);
+  if (current >= 0 && (_indexMask & (1 << current))) {
+    _indexDevice = current;
+  }
+  else{
+    _indexDevice = 0;
+    while (!(_indexMask & (1 << _indexDevice))) {
+      _indexDevice++;
+    }
+  }
+  _indexMask &= ~(1 << _indexDevice);
+
+  if (_player->device != catalogDevices[_indexDevice]) {
+    _player->outputDevice(catalogDevices[_indexDevice]);
+    _switches++;
+    _state = DFPLAYER_CATALOG_SWITCH;
+    return;
+  }
+  indexFolders();
+}
+
+void DFRobotDFPlayerMini2Catalog::indexFolders(){
+  _state = DFPLAYER_CATALOG_FOLDERS;
+  query(0x4F);
+}
+
+void DFRobotDFPlayerMini2Catalog::schedule(){
+  //prefer the oldest play on the current device, switch only if there is none
+  _playIndex = 0;
+  for (uint8_t i=0; i<_queueCount; i++) {
+    if (_queue[i].device == _player->device) {
+      _playIndex = i;
+      playEntry();
+      return;
+    }
+  }
+  _player->outputDevice(_queue[0].device);
+  _switches++;
+  _switchStart = millis();
+  _state = DFPLAYER_CATALOG_PLAY_SWITCH;
+}
+
+void DFRobotDFPlayerMini2Catalog::playEntry(){
+  //clear() or a removed device may have emptied the queue during the switch
+  if (_playIndex >= _queueCount) {
+    _state = DFPLAYER_CATALOG_IDLE;
+    return;
+  }
+  Entry entry = _queue[_playIndex];
+  removeEntry(_playIndex);
+  _player->playFolder(entry.folder, entry.track);
+
+  if (_state == DFPLAYER_CATALOG_PLAY_SWITCH) {
+    _switchLatency = millis() - _switchStart;
+    if (_switchLatency > _switchLatencyMax) {
+      _switchLatencyMax = _switchLatency;
+    }
+#ifdef _DEBUG
+    Serial.print(F("Device switch latency: "));
+    Serial.print(_switchLatency);
+    Serial.println(F(" ms"));
+#endif
+  }
+
+  _started = false;
+  _finished = false;
+  _timer = millis();
+  _state = DFPLAYER_CATALOG_PLAYING;
+}
+
+void DFRobotDFPlayerMini2Catalog::removeEntry(uint8_t index){
+  if (index >= _queueCount) {
+    return;
+  }
+  for (uint8_t i=index; i+1<_queueCount; i++) {
+    _queue[i] = _queue[i+1];
+  }
+  _queueCount--;
+}
+
+bool DFRobotDFPlayerMini2Catalog::play(uint8_t device, uint8_t folder, uint8_t track){
+  int8_t index = deviceIndex(device);
+  if (index < 0 || _queueCount == DFPLAYER_CATALOG_QUEUE_LENGTH) {
+    return false;
+  }
+  if ((_indexed & (1 << index)) && (!folder || folder > _folders[index] || !track || track > _folderFiles[index][folder-1])) {
+    return false;
+  }
+
+  _queue[_queueCount].device = device;
+  _queue[_queueCount].folder = folder;
+  _queue[_queueCount].track = track;
+  _queueCount++;
+  return true;
+}
+
+void DFRobotDFPlayerMini2Catalog::clear(){
+  _queueCount = 0;
+}
+
+uint8_t DFRobotDFPlayerMini2Catalog::readQueueCount(){
+  return _queueCount;
+}
+
+bool DFRobotDFPlayerMini2Catalog::isPresent(uint8_t device){
+  int8_t index = deviceIndex(device);
+  return index >= 0 && _files[index] > 0;
+}
+
+int DFRobotDFPlayerMini2Catalog::readFileCounts(uint8_t device){
+  int8_t index = deviceIndex(device);
+  return (index >= 0) ? _files[index] : -1;
+}
+
+uint8_t DFRobotDFPlayerMini2Catalog::readFolderCounts(uint8_t device){
+  int8_t index = deviceIndex(device);
+  return (index >= 0) ? _folders[index] : 0;
+}
+
+uint8_t DFRobotDFPlayerMini2Catalog::readFileCountsInFolder(uint8_t device, uint8_t folder){
+  int8_t index = deviceIndex(device);
+  if (index < 0 || !folder || folder > _folders[index]) {
+    return 0;
+  }
+  return _folderFiles[index][folder-1];
+}
+
+unsigned int DFRobotDFPlayerMini2Catalog::readSwitches(){
+  return _switches;
+}
+
+unsigned long DFRobotDFPlayerMini2Catalog::readSwitchLatency(){
+  return _switchLatency;
+}
+
+unsigned long DFRobotDFPlayerMini2Catalog::readSwitchLatencyMax(){
+  return _switchLatencyMax;
+}
+
+size_t DFRobotDFPlayerMini2Catalog::readMemoryUse(){
+  return sizeof(DFRobotDFPlayerMini2Catalog);
+}
@@ -0,0 +1,124 @@
+/*!
+ * @file DFRobotDFPlayerMini2Catalog.h
+ * @brief Folder and file catalog of all media of a DFPlayer (U-disk, SD, flash)
+ * @n The catalog is built without blocking from update() and refreshed when a
+ * @n U-disk or SD card is inserted or removed. Plays are queued per device and
+ * @n scheduled so that the module switches the device as rarely as possible;
+ * @n the switches run asynchronously.
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef DFRobotDFPlayerMini2Catalog_h
+    #define DFRobotDFPlayerMini2Catalog_h
+
+#include "DFRobotDFPlayerMini2.h"
+
+#ifndef DFPLAYER_CATALOG_MAX_FOLDERS
+  #define DFPLAYER_CATALOG_MAX_FOLDERS 99  //folders 01..99 can be played with playFolder()
+#endif
+#ifndef DFPLAYER_CATALOG_QUEUE_LENGTH
+  #define DFPLAYER_CATALOG_QUEUE_LENGTH 8
+#endif
+#define DFPLAYER_CATALOG_DEVICES 3  //U-disk, SD, flash
+
+#define DFPLAYER_CATALOG_IDLE 0
+#define DFPLAYER_CATALOG_TOTALS 1       //querying the file count of each device
+#define DFPLAYER_CATALOG_SWITCH 2       //switching to the next device to index
+#define DFPLAYER_CATALOG_FOLDERS 3
+#define DFPLAYER_CATALOG_FILES 4
+#define DFPLAYER_CATALOG_PLAY_SWITCH 5  //switching to the device of the next queued play
+#define DFPLAYER_CATALOG_PLAYING 6
+
+#define DFPLAYER_CATALOG_START_TIME 1000  //ms for BUSY to go low after a play before it counts as failed
+
+class DFRobotDFPlayerMini2Catalog {
+  DFRobotDFPlayerMini2Core *_player;
+
+  int _files[DFPLAYER_CATALOG_DEVICES];  //-1: not present
+  uint8_t _folders[DFPLAYER_CATALOG_DEVICES];
+  uint8_t _folderFiles[DFPLAYER_CATALOG_DEVICES][DFPLAYER_CATALOG_MAX_FOLDERS];
+  uint8_t _indexed = 0;  //bit per device with a valid folder table
+  uint8_t _stale = 0;    //bit per device still to be indexed
+
+  uint8_t _state = DFPLAYER_CATALOG_IDLE;
+  uint8_t _indexDevice;
+  uint8_t _indexMask;
+  uint8_t _indexFolder;
+  uint8_t _homeDevice;
+  bool _waiting = false;
+  uint8_t _expected;
+  unsigned long _timer;
+
+  struct Entry {
+    uint8_t device;
+    uint8_t folder;
+    uint8_t track;
+  };
+  Entry _queue[DFPLAYER_CATALOG_QUEUE_LENGTH];
+  uint8_t _queueCount = 0;
+  uint8_t _playIndex;
+  bool _started;
+  bool _finished;
+
+  unsigned long _switchStart;
+  unsigned int _switches = 0;
+  unsigned long _switchLatency = 0;
+  unsigned long _switchLatencyMax = 0;
+
+  void (*_eventCallback)(uint8_t type, uint16_t parameter) = NULL;
+
+  int8_t deviceIndex(uint8_t device);
+  void query(uint8_t command, uint16_t parameter = 0);
+  void answer(uint16_t value, bool valid);
+  void handleEvent(uint8_t type);
+  void nextTotal();
+  void nextDevice();
+  void indexFolders();
+  void schedule();
+  void playEntry();
+  void removeEntry(uint8_t index);
+
+  public:
+
+  DFRobotDFPlayerMini2Catalog(DFRobotDFPlayerMini2Core &player);
+
+  //indexes all devices again, starts once no queued play is pending
+  void refresh();
+
+  bool isIndexing();
+
+  //drives the player, the indexing and the play queue. Events the catalog does
+  //not consume are passed to the event callback.
+  void update();
+
+  void setEventCallback(void (*callback)(uint8_t type, uint16_t parameter));
+
+  //queues a track of a folder on a device, false if the queue is full or the
+  //catalog knows that the track does not exist
+  bool play(uint8_t device, uint8_t folder, uint8_t track);
+
+  void clear();
+
+  uint8_t readQueueCount();
+
+  bool isPresent(uint8_t device);
+
+  int readFileCounts(uint8_t device);
+
+  uint8_t readFolderCounts(uint8_t device);
+
+  uint8_t readFileCountsInFolder(uint8_t device, uint8_t folder);
+
+  unsigned int readSwitches();
+
+  //ms from the start of a device switch until the queued play was sent
+  unsigned long readSwitchLatency();
+
+  unsigned long readSwitchLatencyMax();
+
+  //RAM used by the catalog in bytes
+  size_t readMemoryUse();
+};
+
+#endif
@@ -0,0 +1,326 @@
+/*!
+ * @file DFRobotDFPlayerMini2Concurrent.h
+ * @brief Thread-safe front end for DFRobotDFPlayerMini2 on RTOS targets
+ * @n Any number of tasks post commands into a lock-free MPSC queue; a single
+ * @n driver task owns the UART and the player instance, executes the commands
+ * @n in order and hands results back through per-request completions. Only the
+ * @n calling task waits for its own result.
+ * @n Needs <atomic>, <mutex> and <condition_variable> (ESP32, Linux), so it is
+ * @n header only and not compiled unless included.
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef DFRobotDFPlayerMini2Concurrent_h
+    #define DFRobotDFPlayerMini2Concurrent_h
+
+#include "DFRobotDFPlayerMini2.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#define DFPLAYER_CONCURRENT_QUEUE_LENGTH 16  //must be a power of two
+#define DFPLAYER_CONCURRENT_IDLE_TIME 5      //ms the driver task sleeps when the queue is empty
+#ifndef DFPLAYER_CONCURRENT_COMPLETIONS
+  #define DFPLAYER_CONCURRENT_COMPLETIONS 32  //completions for call(), requests in flight plus waiting callers
+#endif
+
+//result of a request, shared by the waiting task and the driver task. Each side
+//holds a reference, so a caller that gives up after a timeout does not leave the
+//driver with a dangling pointer. The last release() deletes a completion allocated
+//with new, or returns one of the front end's pool to it.
+class DFPlayerCompletion {
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  bool _done = false;
+  int _result = -1;
+  std::atomic<int> _references;
+  bool _pooled = false;
+  
+  public:
+  
+  DFPlayerCompletion() : _references(1){
+  }
+  
+  //makes this a free completion of a pool, only before it is used
+  void makePooled(){
+    _pooled = true;
+    _references.store(0, std::memory_order_release);
+  }
+  
+  //takes a free pooled completion, false if it is in use
+  bool claim(){
+    int expected = 0;
+    if (!_references.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _done = false;
+    _result = -1;
+    return true;
+  }
+  
+  bool isFree(){
+    return _references.load(std::memory_order_acquire) == 0;
+  }
+  
+  void acquire(){
+    _references.fetch_add(1, std::memory_order_relaxed);
+  }
+  
+  //drops a reference, the last one deletes a completion allocated with new
+  //and frees a pooled one
+  void release(){
+    bool pooled = _pooled;  //a freed pooled completion may be claimed at once
+    if (_references.fetch_sub(1, std::memory_order_acq_rel) == 1 && !pooled) {
+      destroy(this);
+    }
+  }
+  
+  //out of line, so that the compiler does not see a delete of pooled completions
+  static void destroy(DFPlayerCompletion *completion) __attribute__((noinline)){
+    delete completion;
+  }
+  
+  void complete(int result){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _result = result;
+    _done = true;
+    _condition.notify_all();
+  }
+  
+  //returns false if the driver did not finish the request within timeout ms
+  bool wait(unsigned long timeout){
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _condition.wait_for(lock, std::chrono::milliseconds(timeout), [this]{ return _done; });
+  }
+  
+  int result(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _result;
+  }
+};
+
+struct DFPlayerRequest {
+  uint8_t command;
+  uint16_t parameter;
+  DFPlayerCompletion *completion;
+};
+
+//bounded multi-producer single-consumer queue, each slot carries a sequence
+//number that tells producers and the consumer whether it is free or filled.
+class DFPlayerRequestQueue {
+  struct Slot {
+    std::atomic<unsigned int> sequence;
+    DFPlayerRequest request;
+  };
+  Slot _slots[DFPLAYER_CONCURRENT_QUEUE_LENGTH];
+  std::atomic<unsigned int> _tail;
+  unsigned int _head = 0;
+  
+  public:
+  
+  DFPlayerRequestQueue() : _tail(0){
+    for (unsigned int i=0; i<DFPLAYER_CONCURRENT_QUEUE_LENGTH; i++) {
+      _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  
+  bool push(const DFPlayerRequest &request){
+    unsigned int position = _tail.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = _slots[position & (DFPLAYER_CONCURRENT_QUEUE_LENGTH - 1)];
+      int difference = (int)(slot.sequence.load(std::memory_order_acquire) - position);
+      if (difference == 0) {
+        if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          slot.request = request;
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (difference < 0) {
+        return false;  //full
+      }
+      else{
+        position = _tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  
+  //only called by the driver task
+  bool empty(){
+    Slot &slot = _slots[_head & (DFPLAYER_CONCURRENT_QUEUE_LENGTH - 1)];
+    return (int)(slot.sequence.load(std::memory_order_acquire) - (_head + 1)) < 0;
+  }
+  
+  //only called by the driver task
+  bool pop(DFPlayerRequest &request){
+    Slot &slot = _slots[_head & (DFPLAYER_CONCURRENT_QUEUE_LENGTH - 1)];
+    if ((int)(slot.sequence.load(std::memory_order_acquire) - (_head + 1)) < 0) {
+      return false;  //empty
+    }
+    request = slot.request;
+    slot.sequence.store(_head + DFPLAYER_CONCURRENT_QUEUE_LENGTH, std::memory_order_release);
+    _head++;
+    return true;
+  }
+};
+
+class DFRobotDFPlayerMini2Concurrent {
+  DFRobotDFPlayerMini2 &_player;
+  DFPlayerRequestQueue _queue;
+  std::mutex _wakeMutex;
+  std::condition_variable _wake;
+  DFPlayerCompletion _completions[DFPLAYER_CONCURRENT_COMPLETIONS];
+  std::atomic<unsigned int> _nextCompletion;
+  void (*_eventCallback)(uint8_t type, uint16_t parameter) = NULL;
+  
+  static bool isQuery(uint8_t command){
+    return command >= 0x42 && command <= 0x4F;
+  }
+  
+  void forwardEvent(){
+    uint8_t type = _player.readType();
+    uint16_t parameter = _player.read();
+    if (_eventCallback) {
+      _eventCallback(type, parameter);
+    }
+  }
+  
+  DFPlayerCompletion *claimCompletion(){
+    unsigned int start = _nextCompletion.fetch_add(1, std::memory_order_relaxed);
+    for (unsigned int i=0; i<DFPLAYER_CONCURRENT_COMPLETIONS; i++) {
+      DFPlayerCompletion &completion = _completions[(start + i) % DFPLAYER_CONCURRENT_COMPLETIONS];
+      if (completion.claim()) {
+        return &completion;
+      }
+    }
+    return NULL;
+  }
+  
+  int execute(uint8_t command, uint16_t parameter){
+    _player.sendStack(command, parameter);
+    if (!isQuery(command)) {
+      return 0;
+    }
+    
+    unsigned long timer = millis();
+    while (millis() - timer <= _player._timeOutDuration) {
+      if (_player.available()) {
+        if (_player._handleType == DFPlayerFeedBack && _player._handleCommand == command) {
+          _player._isSending = false;
+          _player.readType();
+          return _player.read();
+        }
+        if (_player._handleType == DFPlayerError || _player._handleType == TimeOut) {
+          forwardEvent();
+          return -1;
+        }
+        forwardEvent();
+      }
+      _player.idle(timer, _player._timeOutDuration);
+    }
+    return -1;
+  }
+  
+  public:
+  
+  DFRobotDFPlayerMini2Concurrent(DFRobotDFPlayerMini2 &player) : _player(player), _nextCompletion(0){
+    for (unsigned int i=0; i<DFPLAYER_CONCURRENT_COMPLETIONS; i++) {
+      _completions[i].makePooled();
+    }
+  }
+  
+  //unsolicited events (play finished, card inserted, ...), called from the driver task
+  void setEventCallback(void (*callback)(uint8_t type, uint16_t parameter)){
+    _eventCallback = callback;
+  }
+  
+  //queue a command without waiting, false if the queue is full. The request holds
+  //a reference to completion until the driver has completed it.
+  bool post(uint8_t command, uint16_t parameter = 0, DFPlayerCompletion *completion = NULL){
+    DFPlayerRequest request = {command, parameter, completion};
+    if (completion) {
+      completion->acquire();
+    }
+    if (!_queue.push(request)) {
+      if (completion) {
+        completion->release();
+      }
+      return false;
+    }
+    //notified under the mutex: the driver checks the queue and starts waiting
+    //while holding it, so the request cannot slip in between
+    std::lock_guard<std::mutex> lock(_wakeMutex);
+    _wake.notify_one();
+    return true;
+  }
+  
+  //queue a command and wait for its result (the answer for queries, 0 otherwise), -1 on error
+  //or if all DFPLAYER_CONCURRENT_COMPLETIONS are in use. After a timeout the request
+  //still runs, its result is dropped.
+  int call(uint8_t command, uint16_t parameter = 0, unsigned long timeout = 2000){
+    DFPlayerCompletion *completion = claimCompletion();
+    if (!completion) {
+      return -1;
+    }
+    int result = -1;
+    if (post(command, parameter, completion) && completion->wait(timeout)) {
+      result = completion->result();
+    }
+    completion->release();
+    return result;
+  }
+  
+  //completions of the pool that are not in use
+  unsigned int readFreeCompletions(){
+    unsigned int count = 0;
+    for (unsigned int i=0; i<DFPLAYER_CONCURRENT_COMPLETIONS; i++) {
+      count += _completions[i].isFree();
+    }
+    return count;
+  }
+  
+  void play(int fileNumber = 1){ call(0x03, fileNumber); }
+  void volume(uint8_t volume){ call(0x06, volume); }
+  void playFolder(uint8_t folderNumber, uint8_t fileNumber){ call(0x0F, ((uint16_t)folderNumber << 8) | fileNumber); }
+  void pause(){ call(0x0E); }
+  void start(){ call(0x0D); }
+  void stop(){ call(0x16); }
+  int readState(){ return call(0x42); }
+  int readVolume(){ return call(0x43); }
+  int readEQ(){ return call(0x44); }
+  int readFileCountsInFolder(int folderNumber){ return call(0x4E, folderNumber); }
+  int readFolderCounts(){ return call(0x4F); }
+  
+  //one iteration of the driver task
+  void poll(){
+    DFPlayerRequest request;
+    if (_queue.pop(request)) {
+      int result = execute(request.command, request.parameter);
+      if (request.completion) {
+        request.completion->complete(result);
+        request.completion->release();
+      }
+      return;
+    }
+    
+    _player.update();
+    if (_player.available()) {
+      forwardEvent();
+    }
+    std::unique_lock<std::mutex> lock(_wakeMutex);
+    _wake.wait_for(lock, std::chrono::milliseconds(DFPLAYER_CONCURRENT_IDLE_TIME), [this]{ return !_queue.empty(); });
+  }
+  
+  //body of the driver task, never returns
+  void run(){
+    while (true) {
+      poll();
+    }
+  }
+};
+
+#endif
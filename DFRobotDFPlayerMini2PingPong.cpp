@@ -0,0 +1,219 @@
+/*!
+ * @file DFRobotDFPlayerMini2PingPong.cpp
+ * @brief Gapless playback with two DFPlayer modules playing alternate tracks
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "DFRobotDFPlayerMini2PingPong.h"
+
+DFRobotDFPlayerMini2PingPong::DFRobotDFPlayerMini2PingPong(DFRobotDFPlayerMini2Core &first, DFRobotDFPlayerMini2Core &second){
+  _players[0] = &first;
+  _players[1] = &second;
+}
+
+void DFRobotDFPlayerMini2PingPong::play(uint8_t folder, uint8_t trackCount, uint8_t track){
+  _folder = folder;
+  _trackCount = trackCount;
+  _track = track;
+  _active = 0;
+  _triggered = false;
+  _transitions = 0;
+  _playing = true;
+  
+  _armed[0] = 0;
+  _players[0]->playFolder(_folder, _track);
+  arm(1);
+  _trackStart = millis();
+  _busy[0] = _players[0]->read_play_status_from_pin();
+  _busy[1] = _players[1]->read_play_status_from_pin();
+}
+
+void DFRobotDFPlayerMini2PingPong::stop(){
+  _playing = false;
+  _armed[0] = 0;
+  _armed[1] = 0;
+  _players[0]->stop();
+  _players[1]->stop();
+}
+
+void DFRobotDFPlayerMini2PingPong::setEventCallback(void (*callback)(uint8_t player, uint8_t type, uint16_t parameter)){
+  _eventCallback = callback;
+}
+
+void DFRobotDFPlayerMini2PingPong::enableLoop(){
+  _loop = true;
+}
+
+void DFRobotDFPlayerMini2PingPong::disableLoop(){
+  _loop = false;
+}
+
+void DFRobotDFPlayerMini2PingPong::setLeadTime(unsigned long leadTime, unsigned long (*trackLength)(uint8_t folder, uint8_t track)){
+  _leadTime = leadTime;
+  _trackLength = trackLength;
+}
+
+uint8_t DFRobotDFPlayerMini2PingPong::nextTrack(){
+  if (_track < _trackCount) {
+    return _track + 1;
+  }
+  return _loop ? 1 : 0;
+}
+
+void DFRobotDFPlayerMini2PingPong::arm(uint8_t player){
+  //the file is opened now, the trigger only resumes it. The idle module must not
+  //play, so that its BUSY edge marks the start of the next track.
+  uint8_t track = nextTrack();
+  _armed[player] = track;
+  if (!track) {
+    _players[player]->stop();
+    return;
+  }
+  _players[player]->playFolder(_folder, track);
+  _players[player]->pause();
+}
+
+void DFRobotDFPlayerMini2PingPong::trigger(){
+  _triggered = true;
+  _outgoing = _active;
+  _endSeen = false;
+  _startSeen = false;
+  uint8_t track = nextTrack();
+  uint8_t player = !_outgoing;
+  if (track && _armed[player] == track) {
+    _players[player]->start();
+  }
+  else if (track) {
+    _players[player]->playFolder(_folder, track);  //not armed, e.g. the playlist was changed
+  }
+  _armed[player] = 0;
+}
+
+void DFRobotDFPlayerMini2PingPong::recordGap(){
+  _lastGap = (long)(_startTime - _endTime);
+  if (!_transitions || _lastGap < _minGap) {
+    _minGap = _lastGap;
+  }
+  if (!_transitions || _lastGap > _maxGap) {
+    _maxGap = _lastGap;
+  }
+  _transitions++;
+#ifdef _DEBUG
+  Serial.print(F("Track transition gap: "));
+  Serial.print(_lastGap);
+  Serial.println(F(" ms"));
+#endif
+}
+
+void DFRobotDFPlayerMini2PingPong::update(){
+  unsigned long now = millis();
+  bool finished = false;
+  
+  for (uint8_t i=0; i<2; i++) {
+    _players[i]->update();
+    while (_players[i]->available()) {
+      uint8_t type = _players[i]->readType();
+      uint16_t parameter = _players[i]->read();
+      if (type == DFPlayerPlayFinished) {
+        //only the end of the active track counts; the frame is late if the BUSY
+        //edge has already triggered the next track
+        if (i == _active && _busy[i]) {
+          finished = true;
+        }
+      }
+      else if (_eventCallback) {
+        _eventCallback(i, type, parameter);
+      }
+    }
+  }
+  
+  if (!_playing) {
+    return;
+  }
+  
+  for (uint8_t i=0; i<2; i++) {
+    bool busy = _players[i]->read_play_status_from_pin();
+    if (busy == _busy[i]) {
+      continue;
+    }
+    _busy[i] = busy;
+    
+    if (busy && _armed[i]) {
+      //the pause arrived before the module started the track
+      _players[i]->pause();
+      continue;
+    }
+    if (busy && i == _active && !_triggered) {
+      _trackStart = now;  //lead time counts from the actual start of the track
+    }
+    if (!busy && i == _active && !_triggered) {
+      //the active track ended before the idle module was triggered
+      trigger();
+    }
+    if (!busy && _triggered && i == _outgoing && !_endSeen) {
+      _endSeen = true;
+      _endTime = now;
+    }
+    else if (busy && _triggered && i != _outgoing && !_startSeen) {
+      //the armed module started and takes over the shared playlist position
+      _startSeen = true;
+      _startTime = now;
+      _active = i;
+      _track = nextTrack();
+      _trackStart = now;
+      finished = false;  //a 0x3D read in this update() belongs to the track that just ended
+    }
+    
+    if (_triggered && _endSeen && _startSeen) {
+      recordGap();
+      _triggered = false;
+      arm(_outgoing);
+    }
+  }
+  
+  if (!_triggered && _leadTime && _trackLength) {
+    unsigned long length = _trackLength(_folder, _track);
+    if (length > _leadTime && now - _trackStart >= length - _leadTime) {
+      trigger();
+    }
+  }
+  
+  if (finished && !_triggered) {
+    trigger();
+  }
+  
+  if (_triggered && !nextTrack() && _endSeen) {
+    //end of the playlist
+    _triggered = false;
+    _playing = false;
+  }
+}
+
+bool DFRobotDFPlayerMini2PingPong::isPlaying(){
+  return _playing;
+}
+
+uint8_t DFRobotDFPlayerMini2PingPong::readCurrentFolder(){
+  return _folder;
+}
+
+uint8_t DFRobotDFPlayerMini2PingPong::readCurrentTrack(){
+  return _track;
+}
+
+long DFRobotDFPlayerMini2PingPong::readLastGap(){
+  return _lastGap;
+}
+
+long DFRobotDFPlayerMini2PingPong::readMinGap(){
+  return _minGap;
+}
+
+long DFRobotDFPlayerMini2PingPong::readMaxGap(){
+  return _maxGap;
+}
+
+unsigned int DFRobotDFPlayerMini2PingPong::readTransitions(){
+  return _transitions;
+}
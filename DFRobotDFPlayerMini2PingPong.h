@@ -0,0 +1,93 @@
+/*!
+ * @file DFRobotDFPlayerMini2PingPong.h
+ * @brief Gapless playback with two DFPlayer modules playing alternate tracks
+ * @n While one module plays, the other one is armed with the next track: the
+ * @n track is started and paused at once, so that the trigger only has to
+ * @n resume it. The trigger is the BUSY edge or the 0x3D frame of the active
+ * @n module, or a configurable lead time before the end of the track. The two
+ * @n outputs have to be mixed downstream.
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef DFRobotDFPlayerMini2PingPong_h
+    #define DFRobotDFPlayerMini2PingPong_h
+
+#include "DFRobotDFPlayerMini2.h"
+
+class DFRobotDFPlayerMini2PingPong {
+  DFRobotDFPlayerMini2Core *_players[2];
+  bool _busy[2] = {false, false};
+  uint8_t _armed[2] = {0, 0};  //track loaded and paused on the module, 0: none
+  
+  uint8_t _active = 0;
+  uint8_t _outgoing = 0;
+  bool _playing = false;
+  bool _triggered = false;
+  bool _loop = false;
+  
+  //playlist position shared by both modules
+  uint8_t _folder;
+  uint8_t _track;
+  uint8_t _trackCount;
+  
+  unsigned long _trackStart;
+  unsigned long _leadTime = 0;
+  unsigned long (*_trackLength)(uint8_t folder, uint8_t track) = NULL;
+  
+  unsigned long _endTime;
+  unsigned long _startTime;
+  bool _endSeen = false;
+  bool _startSeen = false;
+  long _lastGap = 0;
+  long _minGap = 0;
+  long _maxGap = 0;
+  unsigned int _transitions = 0;
+  
+  void (*_eventCallback)(uint8_t player, uint8_t type, uint16_t parameter) = NULL;
+  
+  uint8_t nextTrack();
+  void arm(uint8_t player);
+  void trigger();
+  void recordGap();
+  
+  public:
+  
+  DFRobotDFPlayerMini2PingPong(DFRobotDFPlayerMini2Core &first, DFRobotDFPlayerMini2Core &second);
+  
+  //starts the tracks 1..trackCount of the folder, beginning with track
+  void play(uint8_t folder, uint8_t trackCount, uint8_t track = 1);
+  
+  void stop();
+  
+  void update();
+  
+  //events of either module that the ping-pong does not consume, player is 0 or 1
+  void setEventCallback(void (*callback)(uint8_t player, uint8_t type, uint16_t parameter));
+  
+  void enableLoop();
+  
+  void disableLoop();
+  
+  //triggers the idle module leadTime ms before the end of the track, the length
+  //of a track in ms is returned by trackLength
+  void setLeadTime(unsigned long leadTime, unsigned long (*trackLength)(uint8_t folder, uint8_t track));
+  
+  bool isPlaying();
+  
+  uint8_t readCurrentFolder();
+  
+  uint8_t readCurrentTrack();
+  
+  //time in ms between the end of a track and the start of the next one,
+  //negative values are overlaps
+  long readLastGap();
+  
+  long readMinGap();
+  
+  long readMaxGap();
+  
+  unsigned int readTransitions();
+};
+
+#endif
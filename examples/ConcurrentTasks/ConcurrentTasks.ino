@@ -0,0 +1,70 @@
+/***************************************************
+DFPlayer - A Mini MP3 Player For Arduino
+ <https://www.dfrobot.com/product-1121.html>
+ 
+ ***************************************************
+ This example shows how to use the player from several FreeRTOS tasks on ESP32.
+ One driver task owns the UART, the other tasks post commands to it.
+ 
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ All above must be included in any redistribution
+ ****************************************************/
+
+#include "Arduino.h"
+#include "DFRobotDFPlayerMini2Concurrent.h"
+
+DFRobotDFPlayerMini2 myDFPlayer;
+DFRobotDFPlayerMini2Concurrent myPlayerFrontEnd(myDFPlayer);
+
+void driverTask(void *parameter){
+  myPlayerFrontEnd.run();
+}
+
+void volumeTask(void *parameter){
+  while (true) {
+    Serial.print(F("Volume: "));
+    Serial.println(myPlayerFrontEnd.readVolume());  //only this task waits for the answer
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+  }
+}
+
+void playTask(void *parameter){
+  while (true) {
+    myPlayerFrontEnd.post(0x01);  //next, without waiting
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+  }
+}
+
+void printEvent(uint8_t type, uint16_t value){
+  if (type == DFPlayerPlayFinished) {
+    Serial.print(F("Number:"));
+    Serial.print(value);
+    Serial.println(F(" Play Finished!"));
+  }
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial2.begin(9600);
+  
+  if (!myDFPlayer.begin(Serial2)) {
+    Serial.println(F("Unable to begin."));
+    while(true){
+      delay(0);
+    }
+  }
+  myDFPlayer.volume(10);
+  myDFPlayer.play(1);
+  
+  myPlayerFrontEnd.setEventCallback(printEvent);
+  xTaskCreate(driverTask, "dfplayer", 4096, NULL, 2, NULL);
+  xTaskCreate(volumeTask, "volume", 4096, NULL, 1, NULL);
+  xTaskCreate(playTask, "play", 4096, NULL, 1, NULL);
+}
+
+void loop()
+{
+  vTaskDelay(1000 / portTICK_PERIOD_MS);
+}
@@ -21,10 +21,10 @@ DFPlayer - A Mini MP3 Player For Arduino
 
 #include "Arduino.h"
 #include "SoftwareSerial.h"
-#include "DFRobotDFPlayerMini.h"
+#include "DFRobotDFPlayerMini2.h"
 
 SoftwareSerial mySoftwareSerial(10, 11); // RX, TX
-DFRobotDFPlayerMini myDFPlayer;
+DFRobotDFPlayerMini2Core myDFPlayer;  //protocol core only, without the playlist engine
 void printDetail(uint8_t type, int value);
 
 void setup()
@@ -0,0 +1,61 @@
+/***************************************************
+DFPlayer - A Mini MP3 Player For Arduino
+ <https://www.dfrobot.com/product-1121.html>
+ 
+ ***************************************************
+ This example shows the playlist mode: the folders on the SD card are played
+ one after the other, starting with folder 01.
+ 
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ All above must be included in any redistribution
+ ****************************************************/
+
+/***********Notice and Trouble shooting***************
+ 1.Connection and Diagram can be found here
+ <https://www.dfrobot.com/wiki/index.php/DFPlayer_Mini_SKU:DFR0299#Connection_Diagram>
+ 2.This code is tested on Arduino Uno, Leonardo, Mega boards.
+ ****************************************************/
+
+#include "Arduino.h"
+#include "SoftwareSerial.h"
+#include "DFRobotDFPlayerMini2.h"
+
+SoftwareSerial mySoftwareSerial(10, 11); // RX, TX
+DFRobotDFPlayerMini2 myDFPlayer;  //protocol core plus playlist engine
+
+void setup()
+{
+  mySoftwareSerial.begin(9600);
+  Serial.begin(115200);
+  
+  Serial.println();
+  Serial.println(F("DFRobot DFPlayer Mini Playlist Demo"));
+  
+  if (!myDFPlayer.begin(mySoftwareSerial)) {  //Use softwareSerial to communicate with mp3.
+    Serial.println(F("Unable to begin."));
+    while(true){
+      delay(0); // Code to compatible with ESP8266 watch dog.
+    }
+  }
+  myDFPlayer.setBusyPin(PLAYING_PIN);  //BUSY pin of the module
+  myDFPlayer.volume(10);  //Set volume value. From 0 to 30
+  
+  myDFPlayer.get_file_counts();  //Read the number of files in each folder
+  Serial.print(myDFPlayer.pl_mode_read_pl_count());
+  Serial.println(F(" playlists found."));
+  
+  myDFPlayer.enableRecovery();
+  myDFPlayer.pl_mode_change_folder(1, false);
+  myDFPlayer.pl_mode_play_track(0);
+}
+
+void loop()
+{
+  myDFPlayer.update();
+  
+  if (myDFPlayer.pl_mode_check_playback()) {  //Track finished, the next one was started
+    Serial.print(F("Playing track "));
+    Serial.println(myDFPlayer.pl_mode_read_curr_track());
+  }
+}
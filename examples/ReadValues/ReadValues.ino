@@ -22,10 +22,10 @@
 
 #include "Arduino.h"
 #include "SoftwareSerial.h"
-#include "DFRobotDFPlayerMini.h"
+#include "DFRobotDFPlayerMini2.h"
 
 SoftwareSerial mySoftwareSerial(10, 11); // RX, TX
-DFRobotDFPlayerMini myDFPlayer;
+DFRobotDFPlayerMini2Core myDFPlayer;  //protocol core only, without the playlist engine
 void printDetail(uint8_t type, int value);
 
 void setup()
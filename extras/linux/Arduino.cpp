@@ -0,0 +1,142 @@
+/*!
+ * @file Arduino.cpp
+ * @brief Minimal Arduino core for building DFRobotDFPlayerMini2 on Linux
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "Arduino.h"
+#include "LinuxGpio.h"
+
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+ConsoleSerial Serial;
+
+static unsigned long long monotonicMicros(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static const unsigned long long startMicros = monotonicMicros();
+
+unsigned long millis(){
+  return (unsigned long)((monotonicMicros() - startMicros) / 1000);
+}
+
+unsigned long micros(){
+  return (unsigned long)(monotonicMicros() - startMicros);
+}
+
+void delay(unsigned long ms){
+  if (!ms) {
+    sched_yield();
+    return;
+  }
+  struct timespec duration = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+  nanosleep(&duration, NULL);
+}
+
+void delayMicroseconds(unsigned int us){
+  struct timespec duration = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000L};
+  nanosleep(&duration, NULL);
+}
+
+void pinMode(uint8_t pin, uint8_t mode){
+  //lines are configured when they are attached with LinuxGpio::attach()
+  (void)pin;
+  (void)mode;
+}
+
+int digitalRead(uint8_t pin){
+  return LinuxGpio::read(pin);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size){
+  size_t n = 0;
+  while (n < size && write(buffer[n])) {
+    n++;
+  }
+  return n;
+}
+
+size_t Print::print(const char *string){
+  return write((const uint8_t *)string, strlen(string));
+}
+
+size_t Print::print(char value){
+  return write((uint8_t)value);
+}
+
+size_t Print::print(unsigned long value, int base){
+  char buffer[8 * sizeof(long) + 1];
+  char *digit = &buffer[sizeof(buffer) - 1];
+  *digit = '\0';
+  if (base < 2) {
+    base = DEC;
+  }
+  do {
+    unsigned long rest = value % base;
+    value /= base;
+    *--digit = rest < 10 ? '0' + rest : 'A' + rest - 10;
+  } while (value);
+  return print(digit);
+}
+
+size_t Print::print(long value, int base){
+  if (base == DEC && value < 0) {
+    return print('-') + print((unsigned long)-value, base);
+  }
+  return print((unsigned long)value, base);
+}
+
+size_t Print::print(int value, int base){
+  return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base){
+  return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned char value, int base){
+  return print((unsigned long)value, base);
+}
+
+size_t Print::println(){
+  return print("\n");
+}
+
+size_t Print::println(const char *string){
+  return print(string) + println();
+}
+
+size_t Print::println(long value, int base){
+  return print(value, base) + println();
+}
+
+size_t Print::println(unsigned long value, int base){
+  return print(value, base) + println();
+}
+
+size_t Print::println(int value, int base){
+  return print(value, base) + println();
+}
+
+size_t Print::println(unsigned int value, int base){
+  return print(value, base) + println();
+}
+
+size_t Print::println(unsigned char value, int base){
+  return print(value, base) + println();
+}
+
+size_t ConsoleSerial::write(uint8_t value){
+  return fwrite(&value, 1, 1, stdout);
+}
+
+size_t ConsoleSerial::write(const uint8_t *buffer, size_t size){
+  return fwrite(buffer, 1, size, stdout);
+}
@@ -0,0 +1,83 @@
+/*!
+ * @file Arduino.h
+ * @brief Minimal Arduino core for building DFRobotDFPlayerMini2 on Linux
+ * @n Provides the subset of the Arduino API used by the library: timing,
+ * @n digitalRead() for the BUSY pin and the Print/Stream classes.
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef DFPlayerLinux_Arduino_h
+    #define DFPlayerLinux_Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define F(string) (string)
+
+#define DEC 10
+#define HEX 16
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+//single process, nothing to mask
+#define noInterrupts()
+#define interrupts()
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+
+class Print {
+  public:
+  virtual ~Print() {}
+  
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  
+  size_t print(const char *string);
+  size_t print(char value);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(unsigned char value, int base = DEC);
+  
+  size_t println();
+  size_t println(const char *string);
+  size_t println(long value, int base = DEC);
+  size_t println(unsigned long value, int base = DEC);
+  size_t println(int value, int base = DEC);
+  size_t println(unsigned int value, int base = DEC);
+  size_t println(unsigned char value, int base = DEC);
+};
+
+class Stream : public Print {
+  public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+//console output, used by the library when _DEBUG is defined
+class ConsoleSerial : public Print {
+  public:
+  size_t write(uint8_t value);
+  size_t write(const uint8_t *buffer, size_t size);
+};
+
+extern ConsoleSerial Serial;
+
+#endif
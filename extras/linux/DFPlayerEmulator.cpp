@@ -0,0 +1,359 @@
+/*!
+ * @file DFPlayerEmulator.cpp
+ * @brief DFPlayer module emulated on the master side of a pseudo-terminal
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "DFPlayerEmulator.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+DFPlayerEmulator::~DFPlayerEmulator(){
+  end();
+}
+
+bool DFPlayerEmulator::begin(){
+  int slave;
+  if (openpty(&_master, &slave, _port, NULL, NULL) < 0) {
+    return false;
+  }
+  struct termios options;
+  tcgetattr(slave, &options);
+  cfmakeraw(&options);
+  tcsetattr(slave, TCSANOW, &options);
+  _slave = slave;
+  fcntl(_master, F_SETFL, fcntl(_master, F_GETFL) | O_NONBLOCK);
+
+  _busyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _running = true;
+  _thread = std::thread(&DFPlayerEmulator::run, this);
+  return true;
+}
+
+void DFPlayerEmulator::end(){
+  if (!_running) {
+    return;
+  }
+  _running = false;
+  _thread.join();
+  close(_master);
+  close(_slave);
+  close(_busyFd);
+  _master = -1;
+  _slave = -1;
+  _busyFd = -1;
+}
+
+const char *DFPlayerEmulator::port(){
+  return _port;
+}
+
+int DFPlayerEmulator::busy(){
+  std::lock_guard<std::recursive_mutex> lock(_mutex);
+  return (_playState == 1) ? LOW : HIGH;
+}
+
+int DFPlayerEmulator::busyFd(){
+  return _busyFd;
+}
+
+int DFPlayerEmulator::busySource(void *context){
+  return ((DFPlayerEmulator *)context)->busy();
+}
+
+void DFPlayerEmulator::inject(uint8_t command, uint16_t parameter){
+  std::lock_guard<std::recursive_mutex> lock(_mutex);
+  reply(command, parameter, 0);
+}
+
+void DFPlayerEmulator::run(){
+  while (_running) {
+    struct pollfd descriptor;
+    descriptor.fd = _master;
+    descriptor.events = POLLIN;
+    poll(&descriptor, 1, 1);
+
+    uint8_t buffer[64];
+    ssize_t length;
+    while ((length = ::read(_master, buffer, sizeof(buffer))) > 0) {
+      std::lock_guard<std::recursive_mutex> lock(_mutex);
+      for (ssize_t i=0; i<length; i++) {
+        receive(buffer[i]);
+      }
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    tick();
+  }
+}
+
+void DFPlayerEmulator::receive(uint8_t value){
+  if (_frameIndex == 0 && value != 0x7E) {
+    framesRejected++;
+    return;
+  }
+  _frame[_frameIndex++] = value;
+  if (_frameIndex < 10) {
+    return;
+  }
+  _frameIndex = 0;
+
+  uint16_t sum = 0;
+  for (uint8_t i=1; i<7; i++) {
+    sum += _frame[i];
+  }
+  sum = -sum;
+  if (_frame[1] != 0xFF || _frame[2] != 0x06 || _frame[9] != 0xEF || ((_frame[7] << 8) | _frame[8]) != sum) {
+    framesRejected++;
+    return;
+  }
+  unsigned long now = micros();
+  if (framesReceived && now - _lastFrame < minFrameGap) {
+    minFrameGap = now - _lastFrame;
+  }
+  _lastFrame = now;
+  framesReceived++;
+  handle(_frame[3], _frame[4], (_frame[5] << 8) | _frame[6]);
+}
+
+void DFPlayerEmulator::reply(uint8_t command, uint16_t parameter, unsigned long delay){
+  if (_outputCount == DFPLAYER_EMULATOR_OUTPUT_LENGTH) {
+    return;
+  }
+  //frames leave in order, a later reply never overtakes an earlier one
+  unsigned long time = millis() + delay;
+  if (_outputCount && (long)(time - _output[_outputCount-1].time) < 0) {
+    time = _output[_outputCount-1].time;
+  }
+  _output[_outputCount].time = time;
+  _output[_outputCount].command = command;
+  _output[_outputCount].parameter = parameter;
+  _outputCount++;
+}
+
+void DFPlayerEmulator::setPlaying(bool playing){
+  bool wasPlaying = (_playState == 1);
+  _playState = playing ? 1 : (_playState == 1 ? 2 : _playState);
+  if (wasPlaying != playing) {
+    uint64_t edge = 1;
+    ::write(_busyFd, &edge, sizeof(edge));
+  }
+}
+
+uint8_t DFPlayerEmulator::deviceFolders(){
+  return (_device == 1) ? uDiskFolders : folders;
+}
+
+void DFPlayerEmulator::playTrack(uint8_t folder, uint16_t track){
+  if (_playState == 1) {
+    setPlaying(false);
+  }
+  _folder = folder;
+  _track = track;
+  _playState = 0;
+  _starting = true;
+  _startAt = millis() + startLatency;
+  _remaining = trackLength;
+}
+
+void DFPlayerEmulator::handle(uint8_t command, bool ack, uint16_t parameter){
+  if (_booting) {
+    return;
+  }
+  if (locked && command != 0x0C) {
+    return;
+  }
+  if (_sleeping && command != 0x09 && command != 0x0C) {
+    reply(0x40, 0x02, latency);  //sleeping
+    return;
+  }
+
+  //queries are acknowledged ahead of the answer
+  if (ack && command >= 0x3C) {
+    reply(0x41, 0, latency);
+  }
+
+  bool valid = true;
+  switch (command) {
+    case 0x01:  //next
+      playTrack(_folder, _track + 1);
+      break;
+    case 0x02:  //previous
+      playTrack(_folder, _track ? _track - 1 : 1);
+      break;
+    case 0x03:  //play
+    case 0x12:  //play mp3 folder
+    case 0x13:  //advertise
+      if (!parameter || parameter > deviceFolders() * filesPerFolder) {
+        valid = false;
+        break;
+      }
+      playTrack(0, parameter);
+      break;
+    case 0x04:
+      if (_volume < 30) _volume++;
+      break;
+    case 0x05:
+      if (_volume > 0) _volume--;
+      break;
+    case 0x06:
+      _volume = (parameter > 30) ? 30 : parameter;
+      break;
+    case 0x07:
+      _eq = parameter;
+      break;
+    case 0x09:  //output device, also wakes the module
+      _sleeping = false;
+      if ((parameter == 1 && uDiskFolders) || parameter == 2) {
+        if (parameter != _device) {
+          setPlaying(false);
+          _playState = 0;
+          _starting = false;
+          deviceSwitches++;
+        }
+        _device = parameter;
+      }
+      break;
+    case 0x0A:  //sleep
+      setPlaying(false);
+      _playState = 0;
+      _starting = false;
+      _sleeping = true;
+      break;
+    case 0x0C:  //reset
+      setPlaying(false);
+      _playState = 0;
+      _starting = false;
+      _sleeping = false;
+      _device = 2;
+      _booting = true;
+      _bootDone = millis() + bootTime;
+      _outputCount = 0;
+      locked = false;
+      if (ack) {
+        reply(0x41, 0, latency);
+      }
+      return;
+    case 0x0D:  //start
+      if (_playState == 2) {
+        _endAt = millis() + _remaining;
+        setPlaying(true);
+      }
+      break;
+    case 0x0E:  //pause
+      if (_playState == 1) {
+        _remaining = _endAt - millis();
+        setPlaying(false);
+      }
+      else if (_starting) {
+        _starting = false;
+        _playState = 2;
+      }
+      break;
+    case 0x0F:  //play folder
+      if (!(parameter >> 8) || (parameter >> 8) > deviceFolders() || !(parameter & 0xFF) || (parameter & 0xFF) > filesPerFolder) {
+        valid = false;
+        break;
+      }
+      playTrack(parameter >> 8, parameter & 0xFF);
+      break;
+    case 0x16:  //stop
+      setPlaying(false);
+      _playState = 0;
+      _starting = false;
+      break;
+    case 0x42:
+      reply(0x42, _playState == 1 ? 0x0201 : (_playState == 2 ? 0x0202 : 0x0200), latency);
+      return;
+    case 0x43:
+      reply(0x43, _volume, latency);
+      return;
+    case 0x44:
+      reply(0x44, _eq, latency);
+      return;
+    case 0x47:
+      if (!uDiskFolders) {
+        reply(0x40, 0x05, latency);  //no U-disk
+        return;
+      }
+      reply(0x47, uDiskFolders * filesPerFolder, latency);
+      return;
+    case 0x48:
+      reply(0x48, folders * filesPerFolder, latency);
+      return;
+    case 0x49:  //flash: not present
+      reply(0x40, 0x05, latency);
+      return;
+    case 0x4B:
+    case 0x4C:
+    case 0x4D:
+      reply(command, (_folder ? (_folder - 1) * filesPerFolder : 0) + _track, latency);
+      return;
+    case 0x4E:
+      if (!parameter || parameter > deviceFolders() || parameter == failingFolder) {
+        reply(0x40, 0x05, latency);
+        return;
+      }
+      reply(0x4E, filesPerFolder, latency);
+      return;
+    case 0x4F:
+      reply(0x4F, deviceFolders(), latency);
+      return;
+    default:
+      break;
+  }
+
+  if (!valid) {
+    reply(0x40, 0x05, latency);  //file index out of bound
+  }
+  else if (ack) {
+    reply(0x41, 0, latency);
+  }
+}
+
+void DFPlayerEmulator::tick(){
+  unsigned long now = millis();
+
+  if (_booting && (long)(now - _bootDone) >= 0) {
+    _booting = false;
+    reply(0x3F, 0x02, 0);  //SD online
+  }
+  if (_starting && (long)(now - _startAt) >= 0) {
+    _starting = false;
+    _endAt = now + _remaining;
+    setPlaying(true);
+  }
+  if (_playState == 1 && (long)(now - _endAt) >= 0) {
+    setPlaying(false);
+    _playState = 0;
+    reply(0x3D, _track, 0);
+  }
+
+  //send the frames that are due, one at a time at the line speed of 9600 baud
+  while (_outputCount && (long)(now - _output[0].time) >= 0) {
+    uint8_t frame[10] = {0x7E, 0xFF, 0x06, _output[0].command, 0x00,
+      (uint8_t)(_output[0].parameter >> 8), (uint8_t)_output[0].parameter, 0, 0, 0xEF};
+    uint16_t sum = 0;
+    for (uint8_t i=1; i<7; i++) {
+      sum += frame[i];
+    }
+    sum = -sum;
+    frame[7] = sum >> 8;
+    frame[8] = sum;
+    ::write(_master, frame, sizeof(frame));
+    for (uint8_t i=1; i<_outputCount; i++) {
+      _output[i-1] = _output[i];
+    }
+    _outputCount--;
+    if (_outputCount && (long)(_output[0].time - (now + 10)) < 0) {
+      _output[0].time = now + 10;
+    }
+    now = millis();
+  }
+}
@@ -0,0 +1,113 @@
+/*!
+ * @file DFPlayerEmulator.h
+ * @brief DFPlayer module emulated on the master side of a pseudo-terminal
+ * @n The library talks to the slave side through LinuxSerial as to a real
+ * @n module. The emulator answers ACKs and queries after a configurable
+ * @n latency, plays tracks of a fixed length (BUSY output, 0x3D when a track
+ * @n ends), sleeps, resets with the 0x3F online frame and can be locked up to
+ * @n test error handling. Besides the SD card it can have a U-disk to switch to.
+ * @n Used by the tests and benchmarks in this directory.
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef DFPlayerEmulator_h
+    #define DFPlayerEmulator_h
+
+#include "Arduino.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#define DFPLAYER_EMULATOR_OUTPUT_LENGTH 32
+
+class DFPlayerEmulator {
+  int _master = -1;
+  int _slave = -1;  //kept open so that the master never reads EIO
+  int _busyFd = -1;
+  char _port[64];
+  std::thread _thread;
+  std::atomic<bool> _running{false};
+  std::recursive_mutex _mutex;
+
+  //frames scheduled for output, sent by the emulator thread when they are due
+  struct Output {
+    unsigned long time;
+    uint8_t command;
+    uint16_t parameter;
+  };
+  Output _output[DFPLAYER_EMULATOR_OUTPUT_LENGTH];
+  uint8_t _outputCount = 0;
+
+  uint8_t _frame[10];
+  uint8_t _frameIndex = 0;
+  unsigned long _lastFrame;
+
+  //module state
+  uint8_t _device = 2;  //1 U-disk, 2 SD
+  bool _sleeping = false;
+  bool _booting = false;
+  unsigned long _bootDone;
+  uint8_t _volume = 25;
+  uint8_t _eq = 0;
+  uint8_t _folder = 0;
+  uint16_t _track = 0;
+  uint8_t _playState = 0;  //0 stopped, 1 playing, 2 paused
+  bool _starting = false;
+  unsigned long _startAt;
+  unsigned long _endAt;
+  unsigned long _remaining;
+
+  void run();
+  void receive(uint8_t value);
+  void handle(uint8_t command, bool ack, uint16_t parameter);
+  void reply(uint8_t command, uint16_t parameter, unsigned long delay);
+  void playTrack(uint8_t folder, uint16_t track);
+  void setPlaying(bool playing);
+  void tick();
+  uint8_t deviceFolders();
+
+  public:
+
+  //behaviour, may be changed while running
+  std::atomic<unsigned long> latency{20};      //ms until ACKs and answers are sent
+  std::atomic<unsigned long> startLatency{60}; //ms from a play command until BUSY goes low
+  std::atomic<unsigned long> trackLength{1000};
+  std::atomic<unsigned long> bootTime{500};    //ms from reset until the 0x3F online frame
+  std::atomic<uint8_t> folders{10};
+  std::atomic<uint8_t> filesPerFolder{5};
+  std::atomic<uint8_t> failingFolder{0};       //the file count query (0x4E) of this folder answers an error
+  std::atomic<uint8_t> uDiskFolders{0};        //folders on the U-disk, 0: none. Insertion and removal are reported with inject().
+  std::atomic<bool> locked{false};             //ignores everything but a reset
+
+  //counters
+  std::atomic<unsigned int> framesReceived{0};
+  std::atomic<unsigned int> framesRejected{0};
+  std::atomic<unsigned long> minFrameGap{(unsigned long)-1};  //shortest time between two received frames in us
+  std::atomic<unsigned int> deviceSwitches{0};
+
+  ~DFPlayerEmulator();
+
+  //opens a pty pair and starts the emulator thread
+  bool begin();
+
+  void end();
+
+  //slave side of the pty, to be opened with LinuxSerial::begin()
+  const char *port();
+
+  //BUSY output: LOW while playing
+  int busy();
+
+  //eventfd signalled on BUSY edges, for LinuxEventLoop::begin()
+  int busyFd();
+
+  //for LinuxGpio::attach(pin, DFPlayerEmulator::busySource, &emulator, emulator.busyFd())
+  static int busySource(void *context);
+
+  //sends an unsolicited frame, e.g. 0x3A to emulate an inserted card
+  void inject(uint8_t command, uint16_t parameter);
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*!
+ * @file LinuxEventLoop.cpp
+ * @brief epoll/timerfd based idle hook for DFRobotDFPlayerMini2 on Linux
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "LinuxEventLoop.h"
+#include "LinuxGpio.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static int epollFd = -1;
+static int timerFd = -1;
+static int gpioFd = -1;
+static LinuxSerial *watchedSerial = NULL;
+
+bool LinuxEventLoop::begin(LinuxSerial &serial, int busyFd){
+  end();
+  
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (epollFd < 0 || timerFd < 0) {
+    end();
+    return false;
+  }
+  
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = serial.fd();
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, serial.fd(), &event)) {
+    end();
+    return false;
+  }
+  event.data.fd = timerFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+  if (busyFd >= 0) {
+    event.data.fd = busyFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, busyFd, &event);
+  }
+  
+  gpioFd = busyFd;
+  watchedSerial = &serial;
+  return true;
+}
+
+void LinuxEventLoop::end(){
+  if (epollFd >= 0) {
+    close(epollFd);
+  }
+  if (timerFd >= 0) {
+    close(timerFd);
+  }
+  epollFd = -1;
+  timerFd = -1;
+  gpioFd = -1;
+  watchedSerial = NULL;
+}
+
+void LinuxEventLoop::idle(unsigned long duration){
+  if (epollFd < 0) {
+    delay(duration);
+    return;
+  }
+  //bytes already buffered in user space do not wake up epoll
+  if (watchedSerial->available()) {
+    return;
+  }
+  
+  struct itimerspec deadline;
+  memset(&deadline, 0, sizeof(deadline));
+  deadline.it_value.tv_sec = duration / 1000;
+  deadline.it_value.tv_nsec = (long)(duration % 1000) * 1000000L;
+  if (!duration) {
+    deadline.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(timerFd, 0, &deadline, NULL);
+  
+  struct epoll_event events[3];
+  int count = epoll_wait(epollFd, events, 3, -1);
+  for (int i=0; i<count; i++) {
+    if (events[i].data.fd == timerFd) {
+      uint64_t expirations;
+      if (read(timerFd, &expirations, sizeof(expirations)) < 0) {
+        continue;
+      }
+    }
+    else if (events[i].data.fd == gpioFd) {
+      LinuxGpio::clearEvents(gpioFd);
+    }
+  }
+  
+  memset(&deadline, 0, sizeof(deadline));
+  timerfd_settime(timerFd, 0, &deadline, NULL);
+  uint64_t expirations;
+  if (read(timerFd, &expirations, sizeof(expirations)) < 0) {
+    return;  //timer did not expire, nothing to clear
+  }
+}
@@ -0,0 +1,26 @@
+/*!
+ * @file LinuxEventLoop.h
+ * @brief epoll/timerfd based idle hook for DFRobotDFPlayerMini2 on Linux
+ * @n Pass LinuxEventLoop::idle to setIdleHook(): library waits then block in
+ * @n epoll_wait() until serial data arrives, the BUSY line changes or the
+ * @n deadline armed in a timerfd expires, instead of polling millis().
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef LinuxEventLoop_h
+    #define LinuxEventLoop_h
+
+#include "LinuxSerial.h"
+
+class LinuxEventLoop {
+  public:
+  
+  static bool begin(LinuxSerial &serial, int busyFd = -1);
+  
+  static void end();
+  
+  static void idle(unsigned long duration);
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*!
+ * @file LinuxGpio.cpp
+ * @brief GPIO character device input used as digitalRead() source on Linux
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "LinuxGpio.h"
+
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+struct LinuxGpioLine {
+  bool used;
+  uint8_t pin;
+  int fd;
+  int (*source)(void *context);
+  void *context;
+};
+
+static LinuxGpioLine lines[LINUX_GPIO_MAX_PINS];
+
+static LinuxGpioLine *findLine(uint8_t pin){
+  for (int i=0; i<LINUX_GPIO_MAX_PINS; i++) {
+    if (lines[i].used && lines[i].pin == pin) {
+      return &lines[i];
+    }
+  }
+  return NULL;
+}
+
+static LinuxGpioLine *freeLine(){
+  for (int i=0; i<LINUX_GPIO_MAX_PINS; i++) {
+    if (!lines[i].used) {
+      return &lines[i];
+    }
+  }
+  return NULL;
+}
+
+bool LinuxGpio::attach(uint8_t pin, const char *chip, unsigned int offset){
+  detach(pin);
+  
+  LinuxGpioLine *line = freeLine();
+  if (!line) {
+    return false;
+  }
+  
+  int chipFd = open(chip, O_RDONLY | O_CLOEXEC);
+  if (chipFd < 0) {
+    return false;
+  }
+  
+  struct gpio_v2_line_request request;
+  memset(&request, 0, sizeof(request));
+  request.offsets[0] = offset;
+  request.num_lines = 1;
+  request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  strncpy(request.consumer, "DFPlayer BUSY", sizeof(request.consumer) - 1);
+  
+  int result = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request);
+  close(chipFd);
+  if (result < 0) {
+    return false;
+  }
+  
+  fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+  line->used = true;
+  line->pin = pin;
+  line->fd = request.fd;
+  line->source = NULL;
+  return true;
+}
+
+bool LinuxGpio::attach(uint8_t pin, int (*source)(void *context), void *context, int fd){
+  detach(pin);
+  
+  LinuxGpioLine *line = freeLine();
+  if (!line) {
+    return false;
+  }
+  line->used = true;
+  line->pin = pin;
+  line->fd = fd;
+  line->source = source;
+  line->context = context;
+  return true;
+}
+
+void LinuxGpio::detach(uint8_t pin){
+  LinuxGpioLine *line = findLine(pin);
+  if (line) {
+    if (!line->source) {  //the fd of a function line belongs to its owner
+      close(line->fd);
+    }
+    line->used = false;
+  }
+}
+
+int LinuxGpio::read(uint8_t pin){
+  LinuxGpioLine *line = findLine(pin);
+  if (!line) {
+    return HIGH;
+  }
+  if (line->source) {
+    return line->source(line->context);
+  }
+  
+  struct gpio_v2_line_values values;
+  values.bits = 0;
+  values.mask = 1;
+  if (ioctl(line->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+    return HIGH;
+  }
+  return (values.bits & 1) ? HIGH : LOW;
+}
+
+int LinuxGpio::fd(uint8_t pin){
+  LinuxGpioLine *line = findLine(pin);
+  return line ? line->fd : -1;
+}
+
+void LinuxGpio::clearEvents(int fd){
+  //edge events of a GPIO line, or the counter of an eventfd used by a function line
+  struct gpio_v2_line_event event;
+  while (::read(fd, &event, sizeof(event)) == (ssize_t)sizeof(event)) {
+  }
+}
@@ -0,0 +1,39 @@
+/*!
+ * @file LinuxGpio.h
+ * @brief GPIO character device input used as digitalRead() source on Linux
+ * @n Maps Arduino pin numbers (e.g. the BUSY pin given to setBusyPin()) to
+ * @n lines of /dev/gpiochip*. Lines are requested with edge detection, so
+ * @n their file descriptor can wake up LinuxEventLoop on BUSY changes.
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef LinuxGpio_h
+    #define LinuxGpio_h
+
+#include "Arduino.h"
+
+#define LINUX_GPIO_MAX_PINS 4
+
+class LinuxGpio {
+  public:
+  
+  static bool attach(uint8_t pin, const char *chip, unsigned int offset);
+  
+  //line driven by a function instead of a GPIO chip, e.g. the BUSY output of
+  //DFPlayerEmulator; fd (optional) becomes readable on edges
+  static bool attach(uint8_t pin, int (*source)(void *context), void *context, int fd = -1);
+  
+  static void detach(uint8_t pin);
+  
+  //value of the line, HIGH for pins that are not attached (BUSY idle level)
+  static int read(uint8_t pin);
+  
+  //file descriptor signalling edges of the line, -1 if not attached
+  static int fd(uint8_t pin);
+  
+  //discard pending edge events of the line
+  static void clearEvents(int fd);
+};
+
+#endif
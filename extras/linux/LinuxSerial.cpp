@@ -0,0 +1,140 @@
+/*!
+ * @file LinuxSerial.cpp
+ * @brief termios serial port implementing the Arduino Stream interface
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "LinuxSerial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t baudToSpeed(unsigned long baud){
+  switch (baud) {
+    case 1200:
+      return B1200;
+    case 2400:
+      return B2400;
+    case 4800:
+      return B4800;
+    case 19200:
+      return B19200;
+    case 38400:
+      return B38400;
+    case 57600:
+      return B57600;
+    case 115200:
+      return B115200;
+    case 9600:
+    default:
+      return B9600;
+  }
+}
+
+LinuxSerial::~LinuxSerial(){
+  end();
+}
+
+bool LinuxSerial::begin(const char *path, unsigned long baud){
+  end();
+  
+  _fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (_fd < 0) {
+    return false;
+  }
+  
+  struct termios settings;
+  if (tcgetattr(_fd, &settings)) {
+    end();
+    return false;
+  }
+  cfmakeraw(&settings);
+  settings.c_cflag |= CLOCAL | CREAD;
+  settings.c_cflag &= ~(CSTOPB | CRTSCTS);
+  settings.c_cc[VMIN] = 0;
+  settings.c_cc[VTIME] = 0;
+  cfsetispeed(&settings, baudToSpeed(baud));
+  cfsetospeed(&settings, baudToSpeed(baud));
+  if (tcsetattr(_fd, TCSANOW, &settings)) {
+    end();
+    return false;
+  }
+  tcflush(_fd, TCIOFLUSH);
+  return true;
+}
+
+void LinuxSerial::end(){
+  if (_fd >= 0) {
+    close(_fd);
+    _fd = -1;
+  }
+  _bufferIndex = 0;
+  _bufferLength = 0;
+}
+
+int LinuxSerial::fd(){
+  return _fd;
+}
+
+bool LinuxSerial::fill(){
+  if (_bufferIndex < _bufferLength) {
+    return true;
+  }
+  if (_fd < 0) {
+    return false;
+  }
+  ssize_t length = ::read(_fd, _buffer, LINUX_SERIAL_BUFFER_LENGTH);
+  if (length <= 0) {
+    return false;
+  }
+  _bufferIndex = 0;
+  _bufferLength = length;
+  return true;
+}
+
+int LinuxSerial::available(){
+  if (!fill()) {
+    return 0;
+  }
+  return _bufferLength - _bufferIndex;
+}
+
+int LinuxSerial::read(){
+  if (!fill()) {
+    return -1;
+  }
+  return _buffer[_bufferIndex++];
+}
+
+int LinuxSerial::peek(){
+  if (!fill()) {
+    return -1;
+  }
+  return _buffer[_bufferIndex];
+}
+
+size_t LinuxSerial::write(uint8_t value){
+  return write(&value, 1);
+}
+
+size_t LinuxSerial::write(const uint8_t *buffer, size_t size){
+  size_t written = 0;
+  while (_fd >= 0 && written < size) {
+    ssize_t length = ::write(_fd, buffer + written, size - written);
+    if (length > 0) {
+      written += length;
+    }
+    else if (length < 0 && errno == EAGAIN) {
+      struct pollfd output = {_fd, POLLOUT, 0};
+      poll(&output, 1, 100);
+    }
+    else if (length < 0 && errno != EINTR) {
+      break;
+    }
+  }
+  return written;
+}
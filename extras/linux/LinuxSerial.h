@@ -0,0 +1,47 @@
+/*!
+ * @file LinuxSerial.h
+ * @brief termios serial port implementing the Arduino Stream interface
+ * @n Works with /dev/ttyS*, /dev/ttyUSB*, /dev/ttyAMA* and pseudo-terminals.
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#ifndef LinuxSerial_h
+    #define LinuxSerial_h
+
+#include "Arduino.h"
+
+#define LINUX_SERIAL_BUFFER_LENGTH 64
+
+class LinuxSerial : public Stream {
+  int _fd = -1;
+  
+  uint8_t _buffer[LINUX_SERIAL_BUFFER_LENGTH];
+  uint8_t _bufferIndex = 0;
+  uint8_t _bufferLength = 0;
+  
+  bool fill();
+  
+  public:
+  
+  ~LinuxSerial();
+  
+  bool begin(const char *path, unsigned long baud = 9600);
+  
+  void end();
+  
+  //file descriptor of the port, e.g. for waiting with epoll
+  int fd();
+  
+  int available();
+  
+  int read();
+  
+  int peek();
+  
+  size_t write(uint8_t value);
+  
+  size_t write(const uint8_t *buffer, size_t size);
+};
+
+#endif
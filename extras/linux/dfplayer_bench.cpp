@@ -0,0 +1,122 @@
+/*!
+ * @file dfplayer_bench.cpp
+ * @brief Throughput and latency benchmark of the library against DFPlayerEmulator
+ * @n The library talks to the emulated module over a pseudo-terminal, so the
+ * @n numbers include the tty layer but no real 9600 baud line.
+ * @n dfplayer_bench [commands] [latency ms]
+ * @n   - command throughput with and without ACK
+ * @n   - query round trip (readVolume())
+ * @n   - CPU duty cycle while waiting, spinning and with LinuxEventLoop
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "DFRobotDFPlayerMini2.h"
+#include "DFPlayerEmulator.h"
+#include "LinuxEventLoop.h"
+#include "LinuxGpio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double cpuTime(){
+  struct timespec now;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void throughput(LinuxSerial &port, DFPlayerEmulator &emulator, bool ack, int commands){
+  DFRobotDFPlayerMini2 player;
+  player.begin(port, ack, false);
+  unsigned int received = emulator.framesReceived;
+  unsigned long start = micros();
+  for (int i=0; i<commands; i++) {
+    player.volume(10 + i % 10);
+  }
+  //the last frames are still queued (no ACK) or waiting for the ACK
+  while (emulator.framesReceived - received < (unsigned int)commands && micros() - start < 60000000UL) {
+    player.update();
+    player.available();
+  }
+  unsigned long elapsed = micros() - start;
+  printf("%-8s %5d commands %8.1f ms %7.1f commands/s %7.0f us/command\n", ack ? "ACK" : "no ACK",
+         commands, elapsed / 1000.0, commands * 1e6 / elapsed, (double)elapsed / commands);
+
+  //drop the ACKs still on the way, the next player starts on a quiet line
+  delay(emulator.latency + 50);
+  while (port.available()) {
+    port.read();
+  }
+}
+
+static void roundTrip(DFRobotDFPlayerMini2 &player, int queries){
+  unsigned long minimum = (unsigned long)-1;
+  unsigned long maximum = 0;
+  unsigned long total = 0;
+  int failed = 0;
+  for (int i=0; i<queries; i++) {
+    unsigned long start = micros();
+    int volume = player.readVolume();
+    unsigned long elapsed = micros() - start;
+    if (volume < 0) {
+      failed++;
+      continue;
+    }
+    total += elapsed;
+    if (elapsed < minimum) minimum = elapsed;
+    if (elapsed > maximum) maximum = elapsed;
+  }
+  int answered = queries - failed;
+  printf("query    %5d queries  min %6lu us avg %6lu us max %6lu us failed %d\n", queries,
+         answered ? minimum : 0, answered ? total / answered : 0, maximum, failed);
+}
+
+static void dutyCycle(DFRobotDFPlayerMini2 &player, const char *name, int queries){
+  double cpu = cpuTime();
+  unsigned long start = micros();
+  for (int i=0; i<queries; i++) {
+    player.readVolume();
+  }
+  double wall = (micros() - start) / 1e6;
+  printf("%-8s CPU %5.1f %% of %.2f s\n", name, (cpuTime() - cpu) * 100 / wall, wall);
+}
+
+int main(int argc, char **argv){
+  int commands = (argc > 1) ? atoi(argv[1]) : 100;
+  unsigned long latency = (argc > 2) ? atol(argv[2]) : 20;
+
+  DFPlayerEmulator emulator;
+  if (!emulator.begin()) {
+    perror("openpty");
+    return 1;
+  }
+  emulator.latency = latency;
+
+  LinuxSerial port;
+  if (!port.begin(emulator.port(), 9600)) {
+    perror(emulator.port());
+    return 1;
+  }
+  LinuxGpio::attach(PLAYING_PIN, DFPlayerEmulator::busySource, &emulator, emulator.busyFd());
+
+  printf("emulator on %s, module latency %lu ms\n", emulator.port(), latency);
+  throughput(port, emulator, false, commands);
+  throughput(port, emulator, true, commands);
+
+  DFRobotDFPlayerMini2 player;
+  if (!player.begin(port)) {
+    printf("no answer from the emulator on %s\n", emulator.port());
+    return 1;
+  }
+  roundTrip(player, commands);
+
+  dutyCycle(player, "spinning", commands / 4);
+  LinuxEventLoop::begin(port, emulator.busyFd());
+  player.setIdleHook(LinuxEventLoop::idle);
+  dutyCycle(player, "epoll", commands / 4);
+  LinuxEventLoop::end();
+
+  printf("frames received %u, rejected %u\n", (unsigned int)emulator.framesReceived, (unsigned int)emulator.framesRejected);
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*!
+ * @file dfplayer_concurrent.cpp
+ * @brief Contention test and benchmark of DFRobotDFPlayerMini2Concurrent
+ * @n A driver thread owns the player, which talks to DFPlayerEmulator over a
+ * @n pseudo-terminal. Several std::threads call commands and queries at the same
+ * @n time; the test checks that every answer is valid and reports throughput and
+ * @n call latency. A second round gives up on its calls after 1 ms, so that the
+ * @n driver completes requests whose callers have gone (build with
+ * @n -fsanitize=address or -fsanitize=thread to check the completion lifetime);
+ * @n afterwards all completions must be back in the pool.
+ * @n dfplayer_concurrent [threads] [calls per thread]
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "DFRobotDFPlayerMini2Concurrent.h"
+#include "DFPlayerEmulator.h"
+#include "LinuxSerial.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+static std::atomic<bool> driving(true);
+static std::atomic<unsigned int> invalid(0);
+static std::atomic<unsigned int> failed(0);
+
+static void driver(DFRobotDFPlayerMini2Concurrent *frontEnd){
+  while (driving) {
+    frontEnd->poll();
+  }
+}
+
+static void client(DFRobotDFPlayerMini2Concurrent *frontEnd, int id, int calls, unsigned long timeout, std::vector<unsigned long> *latencies){
+  for (int i=0; i<calls; i++) {
+    unsigned long start = micros();
+    int result;
+    if (i % 2) {
+      result = frontEnd->call(0x43, 0, timeout);  //readVolume()
+      if (result > 30) {
+        invalid++;
+      }
+    }
+    else{
+      result = frontEnd->call(0x06, (id + i) % 31, timeout);  //volume()
+      if (result > 0) {
+        invalid++;
+      }
+    }
+    if (result < 0) {
+      failed++;
+    }
+    latencies->push_back(micros() - start);
+  }
+}
+
+static void round(DFRobotDFPlayerMini2Concurrent &frontEnd, const char *name, int threads, int calls, unsigned long timeout){
+  std::vector<std::thread> clients;
+  std::vector<std::vector<unsigned long> > latencies(threads);
+  invalid = 0;
+  failed = 0;
+
+  unsigned long start = micros();
+  for (int i=0; i<threads; i++) {
+    clients.push_back(std::thread(client, &frontEnd, i, calls, timeout, &latencies[i]));
+  }
+  for (int i=0; i<threads; i++) {
+    clients[i].join();
+  }
+  unsigned long elapsed = micros() - start;
+
+  std::vector<unsigned long> all;
+  for (int i=0; i<threads; i++) {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+  }
+  std::sort(all.begin(), all.end());
+  printf("%-8s %2d threads %5lu calls %7.1f calls/s  latency p50 %7lu us p99 %7lu us max %7lu us  failed %u invalid %u\n",
+         name, threads, (unsigned long)all.size(), all.size() * 1e6 / elapsed,
+         all[all.size() / 2], all[all.size() * 99 / 100], all.back(), (unsigned int)failed, (unsigned int)invalid);
+}
+
+int main(int argc, char **argv){
+  int threads = (argc > 1) ? atoi(argv[1]) : 8;
+  int calls = (argc > 2) ? atoi(argv[2]) : 20;
+
+  DFPlayerEmulator emulator;
+  if (!emulator.begin()) {
+    perror("openpty");
+    return 1;
+  }
+  LinuxSerial port;
+  if (!port.begin(emulator.port(), 9600)) {
+    perror(emulator.port());
+    return 1;
+  }
+
+  DFRobotDFPlayerMini2 player;
+  if (!player.begin(port)) {
+    printf("no answer from the emulator on %s\n", emulator.port());
+    return 1;
+  }
+  DFRobotDFPlayerMini2Concurrent frontEnd(player);
+  std::thread driverThread(driver, &frontEnd);
+
+  round(frontEnd, "waiting", threads, calls, 60000);
+  unsigned int waitingInvalid = invalid;
+  unsigned int waitingFailed = failed;
+
+  //callers give up at once, the driver still completes their requests later
+  round(frontEnd, "timeout", threads, calls, 1);
+  delay(DFPLAYER_CONCURRENT_QUEUE_LENGTH * 100);
+
+  driving = false;
+  driverThread.join();
+  emulator.end();
+
+  if (waitingInvalid || waitingFailed) {
+    printf("FAILED: %u invalid and %u failed calls without timeout\n", waitingInvalid, waitingFailed);
+    return 1;
+  }
+  if (frontEnd.readFreeCompletions() != DFPLAYER_CONCURRENT_COMPLETIONS) {
+    printf("FAILED: %u completions not returned to the pool\n", DFPLAYER_CONCURRENT_COMPLETIONS - frontEnd.readFreeCompletions());
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
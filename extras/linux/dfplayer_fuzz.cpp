@@ -0,0 +1,245 @@
+/*!
+ * @file dfplayer_fuzz.cpp
+ * @brief Fuzz target and property test of the frame parser (parseByte())
+ * @n Invariants checked for every input:
+ * @n   - the parser never writes or reads past _received (_receivedIndex stays below
+ * @n     DFPLAYER_RECEIVED_LENGTH, ASan catches the rest)
+ * @n   - every valid frame of the input is reported, in order, as found by a
+ * @n     reference scanner that takes the first valid frame at each position
+ * @n   - the work per byte is bounded: a byte never makes the parser rescan more
+ * @n     than one frame length
+ * @n libFuzzer:  clang++ -g -O1 -fsanitize=fuzzer,address -DDFPLAYER_LIBFUZZER ...
+ * @n standalone: dfplayer_fuzz [iterations]  random property test plus the
+ * @n             throughput of the parser on worst-case inputs
+ * @n             dfplayer_fuzz <files>       runs the given inputs (e.g. a crash file)
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "DFRobotDFPlayerMini2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+//exposes the parser of the core
+class FuzzParser : public DFRobotDFPlayerMini2Core {
+  public:
+
+  uint8_t parse(uint8_t value){
+    return parseByte(value);
+  }
+
+  uint8_t index(){
+    return _receivedIndex;
+  }
+
+  uint8_t *received(){
+    return _received;
+  }
+};
+
+struct Frame {
+  uint8_t command;
+  uint16_t parameter;
+};
+
+static bool validFrame(const uint8_t *bytes){
+  if (bytes[Stack_Header] != 0x7E || bytes[Stack_Version] != 0xFF || bytes[Stack_Length] != 0x06 || bytes[Stack_End] != 0xEF) {
+    return false;
+  }
+  uint16_t sum = 0;
+  for (int i=Stack_Version; i<Stack_CheckSum; i++) {
+    sum += bytes[i];
+  }
+  sum = -sum;
+  return sum == ((bytes[Stack_CheckSum] << 8) | bytes[Stack_CheckSum+1]);
+}
+
+//reference: the first valid frame at each position, continuing after its end
+static void scan(const uint8_t *data, size_t size, std::vector<Frame> &frames){
+  size_t i = 0;
+  while (i + DFPLAYER_RECEIVED_LENGTH <= size) {
+    if (validFrame(data + i)) {
+      Frame frame = {data[i+Stack_Command], (uint16_t)((data[i+Stack_Parameter] << 8) | data[i+Stack_Parameter+1])};
+      frames.push_back(frame);
+      i += DFPLAYER_RECEIVED_LENGTH;
+    }
+    else{
+      i++;
+    }
+  }
+}
+
+static void fail(const char *message, size_t position){
+  fprintf(stderr, "dfplayer_fuzz: %s at byte %lu\n", message, (unsigned long)position);
+  abort();
+}
+
+static void check(const uint8_t *data, size_t size){
+  FuzzParser parser;
+  std::vector<Frame> expected;
+  scan(data, size, expected);
+
+  size_t reported = 0;
+  for (size_t i=0; i<size; i++) {
+    uint8_t before = parser.index();
+    uint8_t result = parser.parse(data[i]);
+    uint8_t after = parser.index();
+
+    if (after >= DFPLAYER_RECEIVED_LENGTH) {
+      fail("_receivedIndex past _received", i);
+    }
+    //a byte either extends the frame by one or makes resync() keep part of the
+    //bytes buffered so far, it never brings back bytes already discarded
+    if (after > before + 1) {
+      fail("parser state grew by more than one byte", i);
+    }
+    if (result == DFPLAYER_PARSE_COMPLETE) {
+      uint8_t *frame = parser.received();
+      if (!validFrame(frame)) {
+        fail("invalid frame reported", i);
+      }
+      if (reported == expected.size() || expected[reported].command != frame[Stack_Command]
+          || expected[reported].parameter != ((frame[Stack_Parameter] << 8) | frame[Stack_Parameter+1])) {
+        fail("frame reported out of order or not in the input", i);
+      }
+      reported++;
+    }
+  }
+  if (reported != expected.size()) {
+    fail("valid frame not reported", size);
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+  check(data, size);
+  return 0;
+}
+
+#ifndef DFPLAYER_LIBFUZZER
+
+static void appendFrame(std::vector<uint8_t> &input, uint8_t command, uint16_t parameter){
+  uint8_t frame[DFPLAYER_RECEIVED_LENGTH] = {0x7E, 0xFF, 0x06, command, 0x00, (uint8_t)(parameter >> 8), (uint8_t)parameter, 0, 0, 0xEF};
+  uint16_t sum = 0;
+  for (int i=Stack_Version; i<Stack_CheckSum; i++) {
+    sum += frame[i];
+  }
+  sum = -sum;
+  frame[Stack_CheckSum] = sum >> 8;
+  frame[Stack_CheckSum+1] = sum;
+  input.insert(input.end(), frame, frame + sizeof(frame));
+}
+
+//frames, truncated frames, flipped bits and bytes that look like frame delimiters
+static void randomInput(std::vector<uint8_t> &input){
+  static const uint8_t delimiters[] = {0x7E, 0xFF, 0x06, 0xEF};
+  input.clear();
+  int parts = rand() % 16;
+  for (int i=0; i<parts; i++) {
+    size_t start = input.size();
+    switch (rand() % 5) {
+      case 0:
+        appendFrame(input, rand(), rand());
+        break;
+      case 1:
+        appendFrame(input, rand(), rand());
+        input.resize(start + rand() % DFPLAYER_RECEIVED_LENGTH);
+        break;
+      case 2:
+        appendFrame(input, rand(), rand());
+        input[start + rand() % DFPLAYER_RECEIVED_LENGTH] ^= 1 << (rand() % 8);
+        break;
+      case 3:
+        for (int j=rand() % 8; j>0; j--) {
+          input.push_back(delimiters[rand() % sizeof(delimiters)]);
+        }
+        break;
+      default:
+        for (int j=rand() % 8; j>0; j--) {
+          input.push_back(rand());
+        }
+        break;
+    }
+  }
+}
+
+static double throughput(const std::vector<uint8_t> &input, int rounds){
+  FuzzParser parser;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r=0; r<rounds; r++) {
+    for (size_t i=0; i<input.size(); i++) {
+      parser.parse(input[i]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  return seconds * 1e9 / ((double)input.size() * rounds);
+}
+
+static void benchmark(){
+  const size_t length = 100000;
+  std::vector<uint8_t> input;
+
+  for (size_t i=0; i<length; i++) {
+    input.push_back(rand());
+  }
+  printf("random bytes            %6.1f ns/byte\n", throughput(input, 20));
+
+  input.clear();
+  while (input.size() < length) {
+    appendFrame(input, 0x3D, input.size());
+  }
+  printf("valid frames            %6.1f ns/byte\n", throughput(input, 20));
+
+  //every byte starts a header that stays a valid prefix until the end byte
+  input.assign(length, 0x7E);
+  printf("0x7E only               %6.1f ns/byte\n", throughput(input, 20));
+
+  //frames that fail the checksum, each with headers inside that resync() keeps
+  input.clear();
+  while (input.size() < length) {
+    static const uint8_t frame[DFPLAYER_RECEIVED_LENGTH] = {0x7E, 0xFF, 0x06, 0x7E, 0x7E, 0xFF, 0x06, 0x7E, 0xFF, 0xEF};
+    input.insert(input.end(), frame, frame + sizeof(frame));
+  }
+  printf("nested headers          %6.1f ns/byte\n", throughput(input, 20));
+}
+
+int main(int argc, char **argv){
+  int iterations = 100000;
+  if (argc > 1 && atoi(argv[1]) > 0) {
+    iterations = atoi(argv[1]);
+  }
+  else if (argc > 1) {
+    for (int i=1; i<argc; i++) {
+      FILE *file = fopen(argv[i], "rb");
+      if (!file) {
+        perror(argv[i]);
+        return 1;
+      }
+      std::vector<uint8_t> input;
+      int value;
+      while ((value = fgetc(file)) != EOF) {
+        input.push_back(value);
+      }
+      fclose(file);
+      check(input.data(), input.size());
+      printf("%s: ok\n", argv[i]);
+    }
+    return 0;
+  }
+
+  srand(1);
+  std::vector<uint8_t> input;
+  for (int i=0; i<iterations; i++) {
+    randomInput(input);
+    check(input.data(), input.size());
+  }
+  printf("%d random inputs ok\n", iterations);
+  benchmark();
+  return 0;
+}
+
+#endif
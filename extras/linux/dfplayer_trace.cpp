@@ -0,0 +1,416 @@
+/*!
+ * @file dfplayer_trace.cpp
+ * @brief Decoder and replay tool for traces written by dumpTrace()
+ * @n dfplayer_trace <file>           print the trace as a timeline
+ * @n dfplayer_trace --replay [--latency ms] <file>  send the transmitted frames
+ * @n                                 to DFPlayerEmulator with the recorded timing
+ * @n                                 and compare its answers and BUSY edges with
+ * @n                                 the recorded ones
+ * @n dfplayer_trace --parse <file>   feed the received frames through the parser,
+ * @n                                 with the recorded timing, and report the
+ * @n                                 parsed events and the time spent parsing
+ * @n dfplayer_trace --parse --fast <file>  same without the recorded timing
+ *
+ * @copyright	GNU Lesser General Public License
+ */
+
+#include "DFRobotDFPlayerMini2.h"
+#include "DFPlayerEmulator.h"
+#include "LinuxSerial.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+struct Record {
+  uint32_t time;
+  uint8_t type;
+  uint8_t command;
+  uint16_t parameter;
+};
+
+//stream that hands out the bytes pushed into it, used as the player's serial port
+class ReplayStream : public Stream {
+  std::vector<uint8_t> _bytes;
+  size_t _index = 0;
+  
+  public:
+  
+  void push(const uint8_t *buffer, size_t size){
+    _bytes.insert(_bytes.end(), buffer, buffer + size);
+  }
+  
+  int available(){
+    return _bytes.size() - _index;
+  }
+  
+  int read(){
+    return _index < _bytes.size() ? _bytes[_index++] : -1;
+  }
+  
+  int peek(){
+    return _index < _bytes.size() ? _bytes[_index] : -1;
+  }
+  
+  size_t write(uint8_t value){
+    (void)value;
+    return 1;
+  }
+};
+
+static const char *typeName(uint8_t type){
+  switch (type) {
+    case DFPLAYER_TRACE_TX:
+      return "TX";
+    case DFPLAYER_TRACE_RX:
+      return "RX";
+    case DFPLAYER_TRACE_RX_ERROR:
+      return "RX error";
+    case DFPLAYER_TRACE_BUSY:
+      return "BUSY";
+    case DFPLAYER_TRACE_RX_DATA:
+      return "RX data";
+    default:
+      return "?";
+  }
+}
+
+//format 1 recorded only the position of a rejected byte, its frames are replayed approximately
+static uint8_t version;
+
+static bool load(const char *path, std::vector<Record> &records){
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  
+  uint8_t header[7];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, "DFTR", 4) || header[4] < 1 || header[4] > 2) {
+    fprintf(stderr, "%s: not a DFPlayer trace\n", path);
+    fclose(file);
+    return false;
+  }
+  
+  version = header[4];
+  uint16_t count = header[5] | (header[6] << 8);
+  for (uint16_t i=0; i<count; i++) {
+    uint8_t raw[8];
+    if (fread(raw, 1, sizeof(raw), file) != sizeof(raw)) {
+      fprintf(stderr, "%s: truncated after %u entries\n", path, i);
+      break;
+    }
+    Record record;
+    record.time = raw[0] | (raw[1] << 8) | (raw[2] << 16) | ((uint32_t)raw[3] << 24);
+    record.type = raw[4];
+    record.command = raw[5];
+    record.parameter = (raw[6] << 8) | raw[7];
+    records.push_back(record);
+  }
+  fclose(file);
+  return true;
+}
+
+//collects the bytes of the rejected frame recorded at records[index] and its
+//DFPLAYER_TRACE_RX_DATA entries, returns their number
+static uint8_t rejectedBytes(const std::vector<Record> &records, size_t index, uint8_t *bytes){
+  uint8_t length = records[index].command;
+  if (length > DFPLAYER_RECEIVED_LENGTH) {
+    length = DFPLAYER_RECEIVED_LENGTH;
+  }
+  uint8_t recorded[DFPLAYER_RECEIVED_LENGTH + 2] = {0x7E, (uint8_t)(records[index].parameter >> 8), (uint8_t)records[index].parameter};
+  for (uint8_t i=3; i<length; i+=3) {
+    index++;
+    if (index >= records.size() || records[index].type != DFPLAYER_TRACE_RX_DATA) {
+      return i;  //the ring overwrote or cut the rest
+    }
+    recorded[i] = records[index].command;
+    recorded[i+1] = records[index].parameter >> 8;
+    recorded[i+2] = records[index].parameter;
+  }
+  memcpy(bytes, recorded, length);
+  return length;
+}
+
+static void print(const std::vector<Record> &records){
+  for (size_t i=0; i<records.size(); i++) {
+    const Record &record = records[i];
+    uint32_t time = record.time - records[0].time;
+    uint32_t delta = i ? record.time - records[i-1].time : 0;
+    if (record.type == DFPLAYER_TRACE_BUSY) {
+      printf("%10u us  +%7u us  %-8s %s\n", time, delta, typeName(record.type), record.command ? "playing" : "idle");
+    }
+    else if (record.type == DFPLAYER_TRACE_RX_ERROR && version == 1) {
+      printf("%10u us  +%7u us  %-8s at byte %u\n", time, delta, typeName(record.type), record.parameter);
+    }
+    else if (record.type == DFPLAYER_TRACE_RX_ERROR) {
+      uint8_t bytes[DFPLAYER_RECEIVED_LENGTH];
+      uint8_t length = rejectedBytes(records, i, bytes);
+      printf("%10u us  +%7u us  %-8s", time, delta, typeName(record.type));
+      for (uint8_t j=0; j<length; j++) {
+        printf(" %02X", bytes[j]);
+      }
+      printf("\n");
+    }
+    else if (record.type == DFPLAYER_TRACE_RX_DATA) {
+      continue;  //printed with its DFPLAYER_TRACE_RX_ERROR entry
+    }
+    else{
+      printf("%10u us  +%7u us  %-8s 0x%02X 0x%04X\n", time, delta, typeName(record.type), record.command, record.parameter);
+    }
+  }
+}
+
+static uint8_t buildFrame(const std::vector<Record> &records, size_t index, uint8_t *frame){
+  const Record &record = records[index];
+  if (record.type == DFPLAYER_TRACE_RX_ERROR && version > 1) {
+    return rejectedBytes(records, index, frame);
+  }
+  uint8_t stack[DFPLAYER_RECEIVED_LENGTH] = {0x7E, 0xFF, 0x06, record.command, 0x00,
+                                             (uint8_t)(record.parameter >> 8), (uint8_t)record.parameter, 0x00, 0x00, 0xEF};
+  uint16_t sum = 0;
+  for (int i=Stack_Version; i<Stack_CheckSum; i++) {
+    sum += stack[i];
+  }
+  sum = -sum;
+  stack[Stack_CheckSum] = sum >> 8;
+  stack[Stack_CheckSum+1] = sum;
+  if (record.type == DFPLAYER_TRACE_RX_ERROR) {
+    stack[Stack_CheckSum+1]++;  //format 1: a frame that is rejected, not necessarily at the same byte
+  }
+  memcpy(frame, stack, DFPLAYER_RECEIVED_LENGTH);
+  return DFPLAYER_RECEIVED_LENGTH;
+}
+
+static void parse(const std::vector<Record> &records, bool realtime){
+  ReplayStream stream;
+  DFRobotDFPlayerMini2 player;
+  player.begin(stream, false, false);
+  player.readType();
+  
+  unsigned long start = micros();
+  unsigned long parseTime = 0;
+  unsigned long events = 0;
+  unsigned long frames = 0;
+  
+  for (size_t i=0; i<records.size(); i++) {
+    const Record &record = records[i];
+    if (record.type != DFPLAYER_TRACE_RX && record.type != DFPLAYER_TRACE_RX_ERROR) {
+      continue;
+    }
+    if (realtime) {
+      unsigned long due = record.time - records[0].time;
+      while (micros() - start < due) {
+        delayMicroseconds(due - (micros() - start));
+      }
+    }
+    
+    uint8_t frame[DFPLAYER_RECEIVED_LENGTH];
+    stream.push(frame, buildFrame(records, i, frame));
+    frames++;
+    
+    //a rejected frame may end inside the next one, parse until the stream is empty
+    do {
+      unsigned long timer = micros();
+      bool isAvailable = player.available();
+      parseTime += micros() - timer;
+      
+      if (isAvailable) {
+        uint8_t command = player._handleCommand;
+        uint8_t type = player.readType();
+        uint16_t parameter = player.read();
+        printf("%10lu us  event type %2u command 0x%02X parameter 0x%04X\n", micros() - start, type, command, parameter);
+        events++;
+      }
+    } while (stream.available());
+  }
+  
+  printf("%lu frames, %lu events, parse time %lu us (%.2f us/frame)\n",
+         frames, events, parseTime, frames ? (double)parseTime / frames : 0.0);
+}
+
+//frame from the module or BUSY edge, compared between the trace and the emulator
+struct Event {
+  uint32_t time;  //us from the start of the trace
+  uint8_t type;   //DFPLAYER_TRACE_RX or DFPLAYER_TRACE_BUSY
+  uint8_t command;
+  uint16_t parameter;
+  
+  bool operator==(const Event &other) const {
+    return type == other.type && command == other.command && parameter == other.parameter;
+  }
+};
+
+static void printEvent(const char *mark, const Event *recorded, const Event *emulated){
+  const Event &event = recorded ? *recorded : *emulated;
+  printf("%s %-5s 0x%02X 0x%04X", mark, typeName(event.type), event.command, event.parameter);
+  if (recorded) {
+    printf("  recorded %10u us", recorded->time);
+  }
+  if (emulated) {
+    printf("  emulator %10u us", emulated->time);
+  }
+  if (recorded && emulated) {
+    printf(" (%+ld us)", (long)emulated->time - (long)recorded->time);
+  }
+  printf("\n");
+}
+
+//prints the longest common subsequence of both event lists as matches (=) and
+//the rest as recorded only (-) or emulator only (+), returns the differences
+static unsigned int compare(const std::vector<Event> &recorded, const std::vector<Event> &emulated){
+  size_t n = recorded.size();
+  size_t m = emulated.size();
+  std::vector<std::vector<uint16_t> > common(n + 1, std::vector<uint16_t>(m + 1, 0));
+  for (size_t i=n; i-- > 0;) {
+    for (size_t j=m; j-- > 0;) {
+      common[i][j] = (recorded[i] == emulated[j]) ? common[i+1][j+1] + 1
+                     : (common[i+1][j] > common[i][j+1] ? common[i+1][j] : common[i][j+1]);
+    }
+  }
+  
+  unsigned int differences = 0;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < n || j < m) {
+    if (i < n && j < m && recorded[i] == emulated[j]) {
+      printEvent("=", &recorded[i++], &emulated[j++]);
+    }
+    else if (i < n && (j == m || common[i+1][j] >= common[i][j+1])) {
+      printEvent("-", &recorded[i++], NULL);
+      differences++;
+    }
+    else{
+      printEvent("+", NULL, &emulated[j++]);
+      differences++;
+    }
+  }
+  printf("%u recorded, %u emulated, %u matched, %u differences\n", (unsigned int)n, (unsigned int)m,
+         (unsigned int)common[0][0], differences);
+  return differences;
+}
+
+//sends the recorded TX frames to the emulator at their recorded times and
+//collects its answers and BUSY edges until a second after the last entry
+static unsigned int replay(const std::vector<Record> &records, unsigned long latency){
+  DFPlayerEmulator emulator;
+  LinuxSerial port;
+  if (!emulator.begin() || !port.begin(emulator.port(), 9600)) {
+    perror("emulator");
+    return 1;
+  }
+  emulator.latency = latency;
+  
+  //the ACK flag is not traced: a trace with ACKs was recorded in ACK mode
+  bool ack = false;
+  std::vector<Event> recorded;
+  for (size_t i=0; i<records.size(); i++) {
+    const Record &record = records[i];
+    if (record.type == DFPLAYER_TRACE_RX || record.type == DFPLAYER_TRACE_BUSY) {
+      Event event = {record.time - records[0].time, record.type, record.command, record.parameter};
+      recorded.push_back(event);
+      ack |= record.type == DFPLAYER_TRACE_RX && record.command == 0x41;
+    }
+  }
+  
+  std::vector<Event> emulated;
+  uint8_t frame[DFPLAYER_RECEIVED_LENGTH];
+  uint8_t frameIndex = 0;
+  bool playing = !emulator.busy();
+  uint32_t end = records.back().time - records[0].time + 1000000;
+  size_t next = 0;
+  unsigned long start = micros();
+  
+  while (micros() - start < end) {
+    uint32_t now = micros() - start;
+    for (; next < records.size() && records[next].time - records[0].time <= now; next++) {
+      const Record &record = records[next];
+      if (record.type != DFPLAYER_TRACE_TX) {
+        continue;
+      }
+      uint8_t stack[DFPLAYER_SEND_LENGTH] = {0x7E, 0xFF, 0x06, record.command, (uint8_t)ack,
+                                             (uint8_t)(record.parameter >> 8), (uint8_t)record.parameter, 0x00, 0x00, 0xEF};
+      uint16_t sum = 0;
+      for (int i=Stack_Version; i<Stack_CheckSum; i++) {
+        sum += stack[i];
+      }
+      sum = -sum;
+      stack[Stack_CheckSum] = sum >> 8;
+      stack[Stack_CheckSum+1] = sum;
+      port.write(stack, sizeof(stack));
+    }
+    
+    while (port.available()) {
+      uint8_t value = port.read();
+      if (frameIndex == 0 && value != 0x7E) {
+        continue;
+      }
+      frame[frameIndex++] = value;
+      if (frameIndex == DFPLAYER_RECEIVED_LENGTH) {
+        frameIndex = 0;
+        Event event = {(uint32_t)(micros() - start), DFPLAYER_TRACE_RX, frame[Stack_Command],
+                       (uint16_t)((frame[Stack_Parameter] << 8) | frame[Stack_Parameter+1])};
+        emulated.push_back(event);
+      }
+    }
+    
+    if (playing != !emulator.busy()) {
+      playing = !playing;
+      Event event = {(uint32_t)(micros() - start), DFPLAYER_TRACE_BUSY, playing, 0};
+      emulated.push_back(event);
+    }
+    delayMicroseconds(200);
+  }
+  
+  port.end();
+  emulator.end();
+  printf("replayed %s mode, emulator latency %lu ms, rejected frames of the trace are not compared\n",
+         ack ? "ACK" : "no ACK", latency);
+  return compare(recorded, emulated);
+}
+
+int main(int argc, char **argv){
+  bool doReplay = false;
+  bool doParse = false;
+  bool realtime = true;
+  unsigned long latency = 20;
+  const char *path = NULL;
+  
+  for (int i=1; i<argc; i++) {
+    if (!strcmp(argv[i], "--replay")) {
+      doReplay = true;
+    }
+    else if (!strcmp(argv[i], "--parse")) {
+      doParse = true;
+    }
+    else if (!strcmp(argv[i], "--fast")) {
+      realtime = false;
+    }
+    else if (!strcmp(argv[i], "--latency") && i + 1 < argc) {
+      latency = atol(argv[++i]);
+    }
+    else{
+      path = argv[i];
+    }
+  }
+  if (!path) {
+    fprintf(stderr, "usage: %s [--replay [--latency ms] | --parse [--fast]] <trace file>\n", argv[0]);
+    return 2;
+  }
+  
+  std::vector<Record> records;
+  if (!load(path, records)) {
+    return 1;
+  }
+  
+  if (doReplay) {
+    return (records.empty() || replay(records, latency)) ? 1 : 0;
+  }
+  else if (doParse) {
+    parse(records, realtime);
+  }
+  else{
+    print(records);
+  }
+  return 0;
+}
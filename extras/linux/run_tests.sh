@@ -0,0 +1,42 @@
+#!/bin/sh
+# Builds and runs the Linux tests from the repository root:
+#   extras/linux/run_tests.sh [build directory]
+# dfplayer_test runs once with the default configuration and once with all
+# optional features, the event receive test also with a 16 frame queue. The
+# parser fuzz test and the concurrent front end test run under AddressSanitizer
+# and ThreadSanitizer. The trace written by the second run is replayed against
+# the emulator with dfplayer_trace.
+set -e
+
+root=$(cd "$(dirname "$0")/../.." && pwd)
+out=${1:-/tmp/dfplayer_tests}
+mkdir -p "$out"
+cd "$root"
+
+CXX=${CXX:-g++}
+LIBRARY="DFRobotDFPlayerMini2.cpp DFRobotDFPlayerMini2Catalog.cpp DFRobotDFPlayerMini2PingPong.cpp"
+PORT="extras/linux/Arduino.cpp extras/linux/LinuxSerial.cpp extras/linux/LinuxGpio.cpp extras/linux/LinuxEventLoop.cpp extras/linux/DFPlayerEmulator.cpp"
+FLAGS_ALL="-DDFPLAYER_FRAME_QUEUE -DDFPLAYER_HEALTH_MONITOR -DDFPLAYER_FADE -DDFPLAYER_TRACE -DDFPLAYER_SEND_QUEUE -DDFPLAYER_TRIGGER -DDFPLAYER_BEGIN_ASYNC -DDFPLAYER_AUTO_SLEEP"
+
+build(){
+  name=$1
+  shift
+  echo "building $name"
+  $CXX -std=gnu++11 -O1 -g -Wall -I extras/linux -I . "$@" -lutil -pthread -o "$out/$name"
+}
+
+build dfplayer_test $LIBRARY $PORT extras/linux/dfplayer_test.cpp
+build dfplayer_test_all $FLAGS_ALL $LIBRARY $PORT extras/linux/dfplayer_test.cpp
+build dfplayer_test_queue16 -DDFPLAYER_FRAME_QUEUE -DDFPLAYER_FRAME_QUEUE_LENGTH=16 $LIBRARY $PORT extras/linux/dfplayer_test.cpp
+build dfplayer_trace $PORT extras/linux/dfplayer_trace.cpp DFRobotDFPlayerMini2.cpp
+build dfplayer_fuzz -fsanitize=address,undefined DFRobotDFPlayerMini2.cpp extras/linux/Arduino.cpp extras/linux/LinuxGpio.cpp extras/linux/dfplayer_fuzz.cpp
+build dfplayer_concurrent -fsanitize=address $LIBRARY $PORT extras/linux/dfplayer_concurrent.cpp
+build dfplayer_concurrent_tsan -fsanitize=thread $LIBRARY $PORT extras/linux/dfplayer_concurrent.cpp
+
+"$out/dfplayer_test"
+DFPLAYER_TRACE_FILE="$out/test.trace" "$out/dfplayer_test_all"
+"$out/dfplayer_test_queue16" receive_event_counts_drops
+"$out/dfplayer_trace" --replay --latency 5 "$out/test.trace"
+"$out/dfplayer_fuzz" 20000
+"$out/dfplayer_concurrent" 4 10
+TSAN_OPTIONS=halt_on_error=1 "$out/dfplayer_concurrent_tsan" 4 10
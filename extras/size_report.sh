@@ -0,0 +1,49 @@
+#!/bin/sh
+# Flash and RAM use of the core-only (GetStarted, ReadValues) and the playlist
+# (Playlist) configurations of the library.
+# Usage: extras/size_report.sh [fqbn]   (needs arduino-cli with the board core installed)
+#
+# Without arduino-cli the library is compiled for the host with the Linux port
+# in extras/linux instead, once per optional feature: code size of the object
+# file (-Os) and size of the player objects. The numbers show what each flag
+# costs relative to the default build, the absolute values differ from AVR
+# (2 byte pointers and ints on AVR, 8 byte pointers on 64-bit hosts).
+
+FQBN=${1:-arduino:avr:uno}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+if command -v arduino-cli >/dev/null 2>&1; then
+  printf '%-12s %10s %10s\n' sketch flash ram
+  for SKETCH in GetStarted ReadValues Playlist; do
+    OUTPUT=$(arduino-cli compile --fqbn "$FQBN" --library "$ROOT" "$ROOT/examples/$SKETCH" 2>&1)
+    FLASH=$(echo "$OUTPUT" | sed -n 's/^Sketch uses \([0-9]*\) bytes.*/\1/p')
+    RAM=$(echo "$OUTPUT" | sed -n 's/^Global variables use \([0-9]*\) bytes.*/\1/p')
+    printf '%-12s %10s %10s\n' "$SKETCH" "${FLASH:-error}" "${RAM:-error}"
+  done
+  exit 0
+fi
+
+CXX=${CXX:-g++}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/sizes.cpp" <<'EOF'
+#include "DFRobotDFPlayerMini2.h"
+#include <stdio.h>
+int main(){
+  printf("%u %u\n", (unsigned int)sizeof(DFRobotDFPlayerMini2Core), (unsigned int)sizeof(DFRobotDFPlayerMini2));
+  return 0;
+}
+EOF
+
+echo "arduino-cli not found, host build ($($CXX -dumpmachine), MAX_PLAYLIST=255)"
+printf '%-26s %10s %10s %10s\n' flags code Core DFRobotDFPlayerMini2
+ALL="-DDFPLAYER_SEND_QUEUE -DDFPLAYER_FRAME_QUEUE -DDFPLAYER_HEALTH_MONITOR -DDFPLAYER_FADE -DDFPLAYER_TRIGGER -DDFPLAYER_BEGIN_ASYNC -DDFPLAYER_AUTO_SLEEP -DDFPLAYER_TRACE"
+for FLAGS in "" $ALL "$ALL"; do
+  NAME=${FLAGS:-default}
+  [ "$FLAGS" = "$ALL" ] && NAME=all
+  $CXX -std=gnu++11 -Os $FLAGS -I "$ROOT/extras/linux" -I "$ROOT" -c "$ROOT/DFRobotDFPlayerMini2.cpp" -o "$TMP/library.o" &&
+  $CXX -std=gnu++11 $FLAGS -I "$ROOT/extras/linux" -I "$ROOT" "$TMP/sizes.cpp" -o "$TMP/sizes" || exit 1
+  CODE=$(size "$TMP/library.o" | awk 'NR == 2 { print $1 }')
+  printf '%-26s %10s %10s %10s\n' "${NAME#-D}" "$CODE" $("$TMP/sizes")
+done